@@ -0,0 +1,143 @@
+#include "aot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "chip8.h"
+
+// Function-local so generated files can register from their static
+// initialisers whatever order those run in
+static std::vector<const AotProgram*>& programs() {
+    static std::vector<const AotProgram*> list;
+    return list;
+}
+
+bool registerAotProgram(const AotProgram* program) {
+    programs().push_back(program);
+    return true;
+}
+
+const AotProgram* findAotProgram(const Chip8& chip) {
+    // If one ROM is a prefix of another, the longer one is the better match
+    const AotProgram* best = nullptr;
+    for (const AotProgram* program : programs()) {
+        if (program->size > MAX_ROM_SIZE || program->quirks != chip.quirks) continue;
+        if (best && program->size <= best->size) continue;
+        if (memcmp(chip.memory + 0x200, program->image, program->size) == 0) best = program;
+    }
+    return best;
+}
+
+size_t aotProgramCount() {
+    return programs().size();
+}
+
+struct Aot {
+    const AotProgram* program = nullptr;
+    std::vector<uint8_t> dead;     // per block, its bytes no longer hold what was compiled
+    uint8_t covered[4096] = {};    // bytes inside some block
+    uint8_t live[4096] = {};       // start of a block that isn't dead
+};
+
+Aot* createAot() {
+    return new Aot();
+}
+
+void destroyAot(Aot* aot) {
+    delete aot;
+}
+
+void attachAot(Chip8& chip, Aot* aot) {
+    chip.aot = aot;
+    if (aot) aotFlush(*aot, chip);
+}
+
+void detachAot(Chip8& chip) {
+    chip.aot = nullptr;
+}
+
+const AotProgram* aotProgram(const Aot& aot) {
+    return aot.program;
+}
+
+void aotInvalidate(Aot& aot, uint16_t addr) {
+    addr &= 0xFFF;
+    if (!aot.covered[addr]) return;
+    const AotProgram& program = *aot.program;
+    for (size_t i = 0; i < program.blockCount; ++i) {
+        const AotBlock& block = program.blocks[i];
+        if (block.start <= addr && addr < block.end) {
+            aot.dead[i] = 1;
+            aot.live[block.start] = 0;
+        }
+    }
+}
+
+void aotFlush(Aot& aot, const Chip8& chip) {
+    // A state saved after the ROM patched itself matches no program: keep
+    // whatever still matches of the one running, if it's for the same profile
+    const AotProgram* program = findAotProgram(chip);
+    if (!program && aot.program && aot.program->quirks == chip.quirks) program = aot.program;
+    aot.program = program;
+    memset(aot.covered, 0, sizeof(aot.covered));
+    memset(aot.live, 0, sizeof(aot.live));
+    aot.dead.clear();
+    if (!program) return;
+
+    aot.dead.resize(program->blockCount);
+    for (size_t i = 0; i < program->blockCount; ++i) {
+        const AotBlock& block = program->blocks[i];
+        memset(aot.covered + block.start, 1, block.end - block.start);
+        aot.dead[i] = memcmp(chip.memory + block.start, program->image + (block.start - 0x200),
+                             block.end - block.start) != 0;
+        if (!aot.dead[i]) aot.live[block.start] = 1;
+    }
+}
+
+// runCyclesTraced's loop, but stopping at the first block that can run.
+// Returns the number of instructions run.
+static uint64_t interpret(Chip8& chip, const Aot& aot, uint64_t count) {
+    uint16_t pc = chip.pc;
+    const uint64_t base = chip.instructionCount;
+    uint64_t executed = 0;
+    while (executed < count) {
+        const DecodedOp& op = chip.decoded[pc & 0xFFF];
+        chip.instructionCount = base + executed;
+        pc = op.handler(chip, op, pc);
+        executed++;
+        if (pc <= 0xFFF && aot.live[pc]) break;
+    }
+    chip.pc = pc;
+    chip.instructionCount = base + executed;
+    return executed;
+}
+
+void aotRunCycles(Chip8& chip, uint64_t count) {
+    Aot* aot = chip.aot;
+    // Compiled code can't be profiled instruction by instruction
+    if (chip.profiler) aot = nullptr;
+#ifdef CHIP8_TRACE
+    // or traced
+    if (chip.trace) aot = nullptr;
+#endif
+    if (!aot || !aot->program) {
+        runCycles(chip, count);
+        return;
+    }
+    while (count > 0) {
+        count -= aot->program->run(chip, aot->dead.data(), count);
+        if (count > 0 && chip.pc <= 0xFFF && aot->live[chip.pc]) {
+            // The block here doesn't fit in what's left of the count
+            runCycles(chip, count);
+            return;
+        }
+        // Stopped where compiled code doesn't go: interpret up to the next block that can run, looking
+        // for idle loops as often as runCycles does
+        while (count > 0) {
+            count -= skipIdleLoop(chip, count);
+            count -= interpret(chip, *aot, std::min<uint64_t>(count, 64));
+            if (chip.pc <= 0xFFF && aot->live[chip.pc]) break;
+        }
+    }
+}
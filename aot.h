@@ -0,0 +1,74 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "quirks.h"
+
+struct Chip8;
+
+// Ahead-of-time compiled ROMs.
+//
+// chip8_aotc (aotc.cpp) follows a ROM's control flow from 0x200, and turns
+// the code it reaches into a C++ translation unit: one function per ROM, a
+// label per basic block, direct gotos for jumps, calls and skips. Linking
+// that file in registers an AotProgram. With an Aot attached, runs go
+// through whichever program was compiled from the ROM in memory. Anything
+// the compiler couldn't see goes to the interpreter: BNNN and 00EE targets
+// outside the compiled code, unknown opcodes, DXYN when it waits for the
+// display (the VIP profile), and blocks whose bytes were written since they
+// were compiled. Programs are compiled for one quirk profile and only run on
+// machines set to it. The results are identical to runCycles.
+
+// A basic block: bytes [start, end) of the ROM image
+struct AotBlock {
+    uint16_t start;
+    uint16_t end;
+};
+
+// Runs up to `count` instructions from chip.pc, leaving chip.pc and
+// chip.instructionCount where it stopped; blocks with dead[i] set are not
+// entered. Returns the number of instructions run.
+typedef uint64_t (*AotRunFn)(Chip8& chip, const uint8_t* dead, uint64_t count);
+
+struct AotProgram {
+    const char* name;
+    const uint8_t* image;      // the ROM it was compiled from, loaded at 0x200
+    size_t size;
+    const AotBlock* blocks;
+    size_t blockCount;
+    AotRunFn run;
+    QuirkProfile quirks;       // the profile it was compiled for
+};
+
+// Called by the generated files' static initialisers; returns true so it
+// can initialise one
+bool registerAotProgram(const AotProgram* program);
+// Program compiled from the ROM in chip.memory for chip.quirks, or null
+const AotProgram* findAotProgram(const Chip8& chip);
+// Number of programs linked in
+size_t aotProgramCount();
+
+struct Aot;
+
+Aot* createAot();
+void destroyAot(Aot* aot);
+
+// Attach/detach; like a Jit, memory writes through writeMemory and decode
+// cache flushes are forwarded to it while attached
+void attachAot(Chip8& chip, Aot* aot);
+void detachAot(Chip8& chip);
+// The program in use for the ROM in memory, or null if it runs interpreted
+const AotProgram* aotProgram(const Aot& aot);
+
+// Execute exactly `count` instructions, same result as runCycles
+void aotRunCycles(Chip8& chip, uint64_t count);
+
+// Retire any block that covers `addr`
+void aotInvalidate(Aot& aot, uint16_t addr);
+// Memory changed wholesale: pick the program for it and retire the blocks
+// that no longer match
+void aotFlush(Aot& aot, const Chip8& chip);
+
+#endif // AOT_H
@@ -0,0 +1,569 @@
+// Ahead-of-time compiler: turns ROMs into C++ for aot.h.
+//
+//   chip8_aotc <rom>... [-o DIR] [--quirks PROFILE] [--list]
+//
+// Follows each ROM's control flow from 0x200 to find the code that can be
+// reached (jump, call and skip targets, return sites), and writes
+// DIR/aot_<rom name>.cpp with a label per basic block. Bytes never reached
+// are data (sprites, tables) and are left alone. --list prints the code/data
+// map with a disassembly instead of writing anything. The code is for one
+// quirk profile (modern unless --quirks says otherwise), and only runs on
+// machines set to it.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "trace.h"
+
+namespace {
+
+// The profile being compiled for, as values
+struct Quirks {
+    QuirkProfile profile;
+    bool vfReset, memoryIncrement, displayWait, wrap, shiftVy, jumpVx;
+};
+
+Quirks quirksOf(QuirkProfile profile) {
+    return withQuirks(profile, [&](auto q) {
+        typedef decltype(q) Q;
+        return Quirks{ profile, Q::vfReset, Q::memoryIncrement, Q::displayWait, Q::wrap, Q::shiftVy, Q::jumpVx };
+    });
+}
+
+Quirks quirks = quirksOf(QuirkProfile::Modern);
+
+// How control leaves an instruction
+enum class Flow {
+    Next,       // falls through to pc + 2
+    Store,      // falls through, but may have rewritten the code after it
+    Jump,       // 1NNN
+    Call,       // 2NNN
+    Return,     // 00EE
+    Skip,       // pc + 2 or pc + 4
+    Indirect,   // BNNN
+    Interpret,  // left to the interpreter: unknown opcodes (it reports them), the VIP's DXYN, FX0A
+};
+
+// Mirrors decodeOpcode's choice of handler
+Flow flowOf(uint16_t opcode) {
+    unsigned n = opcode & 0xF, nn = opcode & 0xFF;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (nn == 0xE0) return Flow::Next;
+            if (nn == 0xEE) return Flow::Return;
+            if ((opcode & 0x0FE0) == 0x00C0) return Flow::Next;  // 00CN, 00DN
+            if (nn == 0xFB || nn == 0xFC || nn == 0xFE || nn == 0xFF) return Flow::Next;
+            return Flow::Interpret;
+        case 0x1000: return Flow::Jump;
+        case 0x2000: return Flow::Call;
+        case 0x3000: case 0x4000: case 0xE000: return Flow::Skip;
+        case 0x5000: case 0x9000: return n == 0 ? Flow::Skip : Flow::Interpret;
+        case 0x8000: return n <= 0x7 || n == 0xE ? Flow::Next : Flow::Interpret;
+        case 0xB000: return Flow::Indirect;
+        case 0xD000: return quirks.displayWait ? Flow::Interpret : Flow::Next;
+        case 0xF000:
+            switch (nn) {
+                case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x30: case 0x65:
+                case 0x75: case 0x85: case 0x80:
+                    return Flow::Next;
+                case 0x33: case 0x55:
+                    return Flow::Store;
+            }
+            return Flow::Interpret;
+    }
+    return Flow::Next;
+}
+
+struct Analysis {
+    uint8_t memory[4096] = {};
+    size_t size = 0;
+    bool code[4096] = {};       // an instruction reachable from 0x200 starts here
+    bool leader[4096] = {};     // a basic block starts here
+    int indirect = 0;           // BNNNs, whose targets are left to the interpreter
+};
+
+// Instructions outside the image aren't compiled: memory there isn't the ROM's
+bool inImage(const Analysis& a, unsigned addr) {
+    return addr >= 0x200 && addr + 1 < 0x200 + a.size;
+}
+
+uint16_t opcodeAt(const Analysis& a, unsigned addr) {
+    return a.memory[addr] << 8 | a.memory[addr + 1];
+}
+
+// Recursive descent from 0x200 (with an explicit worklist)
+void analyze(Analysis& a) {
+    std::vector<unsigned> work;
+    auto branch = [&](unsigned target) {
+        if (target <= 0xFFF) a.leader[target] = true;
+        work.push_back(target);
+    };
+    branch(0x200);
+    while (!work.empty()) {
+        unsigned addr = work.back();
+        work.pop_back();
+        if (!inImage(a, addr) || a.code[addr]) continue;
+        a.code[addr] = true;
+
+        uint16_t opcode = opcodeAt(a, addr);
+        switch (flowOf(opcode)) {
+            case Flow::Next: work.push_back(addr + 2); break;
+            case Flow::Store: branch(addr + 2); break;
+            case Flow::Jump: branch(opcode & 0xFFF); break;
+            case Flow::Call: branch(opcode & 0xFFF); branch(addr + 2); break;
+            case Flow::Skip: branch(addr + 2); branch(addr + 4); break;
+            case Flow::Indirect: a.indirect++; break;
+            case Flow::Return: break;
+            case Flow::Interpret:
+                // 5XY1 and friends are skipped over, a waiting DXYN moves on after the tick and FX0A once a key comes
+                if ((opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x8000 || (opcode & 0xF000) == 0x9000 ||
+                    (opcode & 0xF000) == 0xD000 || (opcode & 0xF0FF) == 0xF00A) {
+                    branch(addr + 2);
+                }
+                break;
+        }
+    }
+}
+
+// Block starts; one would have to run something, so not an instruction left to the interpreter
+bool compiled(const Analysis& a, unsigned addr) {
+    return addr <= 0xFFF && a.leader[addr] && a.code[addr] && flowOf(opcodeAt(a, addr)) != Flow::Interpret;
+}
+
+struct Block {
+    unsigned start, end;
+    std::vector<unsigned> instructions;
+};
+
+std::vector<Block> findBlocks(const Analysis& a) {
+    std::vector<Block> blocks;
+    for (unsigned start = 0x200; start <= 0xFFF; ++start) {
+        if (!compiled(a, start)) continue;
+        Block block{ start, start, {} };
+        unsigned addr = start;
+        while (true) {
+            block.instructions.push_back(addr);
+            Flow flow = flowOf(opcodeAt(a, addr));
+            addr += 2;
+            if (flow != Flow::Next || !a.code[addr] || a.leader[addr]) break;
+        }
+        block.end = addr;
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+// Control transfer to `target` from generated code
+std::string jumpTo(const Analysis& a, unsigned target) {
+    char text[48];
+    if (compiled(a, target)) std::snprintf(text, sizeof(text), "goto L%03x;", target);
+    else std::snprintf(text, sizeof(text), "{ pc = 0x%x; goto out; }", target);
+    return text;
+}
+
+struct Emitted {
+    std::string code;
+    bool dispatch = false;  // something jumps through the switch
+    bool idle = false;      // some jump checks for an idle loop
+};
+
+// "V[x] <op> V[y]", folded when x == y so the output compiles without
+// self-comparison warnings
+std::string compare(unsigned x, const char* op, unsigned y) {
+    char text[32];
+    if (x == y) return op[0] == '>' && !op[1] ? "false" : op[0] == '!' ? "false" : "true";
+    std::snprintf(text, sizeof(text), "V[%u] %s V[%u]", x, op, y);
+    return text;
+}
+
+// `k` is the instruction's position in its block, which counts `length` instructions
+void emitInstruction(const Analysis& a, unsigned addr, size_t k, size_t length, Emitted& out) {
+    uint16_t opcode = opcodeAt(a, addr);
+    unsigned x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF;
+    unsigned n = opcode & 0xF, nn = opcode & 0xFF, nnn = opcode & 0xFFF;
+    char disasm[32], line[256];
+    disassemble(opcode, disasm, sizeof(disasm));
+    out.code += "    // " + std::string(disasm) + "\n";
+
+    auto emit = [&](const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        out.code += "    ";
+        out.code += line;
+        out.code += "\n";
+    };
+    auto skip = [&](const char* condition) {
+        emit("if (%s) %s", condition, jumpTo(a, addr + 4).c_str());
+        emit("%s", jumpTo(a, addr + 2).c_str());
+    };
+    char condition[96];
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (nn == 0xE0) {
+                emit("memset(c.gfx, 0, screenWords(c.hires) * sizeof(uint64_t));");
+                emit("c.dirtyRows = allRows(c.hires);");
+                emit("c.drawFlag = true;");
+            } else if ((opcode & 0x0FE0) == 0x00C0) {
+                emit("%s(screenOf(c), %u);", y == 0xC ? "scrollDown" : "scrollUp", n);
+                emit("c.drawFlag = true;");
+            } else if (nn == 0xFB || nn == 0xFC) {
+                emit("%s(screenOf(c), 4);", nn == 0xFB ? "scrollRight" : "scrollLeft");
+                emit("c.drawFlag = true;");
+            } else if (nn == 0xFE || nn == 0xFF) {
+                emit("setHires(c, %s);", nn == 0xFF ? "true" : "false");
+                emit("c.drawFlag = true;");
+            } else if (nn == 0xEE) {
+                emit("c.sp--;");
+                emit("pc = c.stack[c.sp & 0xF] + 2;");
+                emit("goto dispatch;");
+                out.dispatch = true;
+            } else {
+                emit("{ pc = 0x%x; goto out; }", addr);
+            }
+            return;
+        case 0x1000:
+            if (nnn <= addr) {
+                // A backward jump may close an idle loop, see skipIdleLoop
+                emit("if (left >= 32 && c.idleSkip) {");
+                emit("    if (c.idleBackoff) c.idleBackoff--;");
+                emit("    else { pc = 0x%x; goto idle; }", nnn);
+                emit("}");
+                out.idle = true;
+            }
+            emit("%s", jumpTo(a, nnn).c_str());
+            return;
+        case 0x2000:
+            emit("c.stack[c.sp & 0xF] = 0x%x;", addr);
+            emit("c.sp++;");
+            emit("%s", jumpTo(a, nnn).c_str());
+            return;
+        case 0x3000:
+            std::snprintf(condition, sizeof(condition), "V[%u] == 0x%02x", x, nn);
+            skip(condition);
+            return;
+        case 0x4000:
+            std::snprintf(condition, sizeof(condition), "V[%u] != 0x%02x", x, nn);
+            skip(condition);
+            return;
+        case 0x5000:
+        case 0x9000:
+            if (n != 0) break;
+            skip(compare(x, opcode < 0x9000 ? "==" : "!=", y).c_str());
+            return;
+        case 0x6000: emit("V[%u] = 0x%02x;", x, nn); return;
+        case 0x7000: emit("V[%u] += 0x%02x;", x, nn); return;
+        case 0x8000:
+            // Same statements in the same order as the handlers, VF aliasing included
+            switch (n) {
+                case 0x0: emit("V[%u] = V[%u];", x, y); return;
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    emit("V[%u] %s= V[%u];", x, n == 0x1 ? "|" : n == 0x2 ? "&" : "^", y);
+                    if (quirks.vfReset) emit("V[15] = 0;");
+                    return;
+                case 0x4:
+                    emit("V[%u] = (uint8_t)(V[%u] + V[%u]);", x, x, y);
+                    emit("V[15] = %s ? 1 : 0;", compare(y, ">", x).c_str());
+                    return;
+                case 0x5:
+                    emit("V[15] = %s ? 1 : 0;", compare(x, ">=", y).c_str());
+                    emit("V[%u] = (uint8_t)(V[%u] - V[%u]);", x, x, y);
+                    return;
+                case 0x6:
+                    emit("V[15] = V[%u] & 0x1;", quirks.shiftVy ? y : x);
+                    emit("V[%u] = V[%u] >> 1;", x, quirks.shiftVy ? y : x);
+                    return;
+                case 0x7:
+                    emit("V[15] = %s ? 1 : 0;", compare(y, ">", x).c_str());
+                    emit("V[%u] = (uint8_t)(V[%u] - V[%u]);", x, y, x);
+                    return;
+                case 0xE:
+                    emit("V[15] = (V[%u] & 0x80) ? 1 : 0;", quirks.shiftVy ? y : x);
+                    emit("V[%u] = (uint8_t)(V[%u] << 1);", x, quirks.shiftVy ? y : x);
+                    return;
+            }
+            break;
+        case 0xA000: emit("c.I = 0x%x;", nnn); return;
+        case 0xB000:
+            emit("pc = 0x%x + V[%u];", nnn, quirks.jumpVx ? x : 0);
+            emit("goto dispatch;");
+            out.dispatch = true;
+            return;
+        case 0xC000:
+            emit("c.rng ^= c.rng << 13;");
+            emit("c.rng ^= c.rng >> 17;");
+            emit("c.rng ^= c.rng << 5;");
+            emit("V[%u] = (uint8_t)(c.rng >> 24) & 0x%02x;", x, nn);
+            return;
+        case 0xD000:
+            if (quirks.displayWait) break;
+            emit("V[15] = drawSprite<%s>(screenOf(c), c.memory, c.I, V[%u], V[%u], %u) ? 1 : 0;",
+                 quirks.wrap ? "true" : "false", x, y, n);
+            emit("c.drawFlag = true;");
+            return;
+        case 0xE000:
+            std::snprintf(condition, sizeof(condition), "%sV[%u] < 16 && c.keypad[V[%u]] == 1%s",
+                          nn == 0xA1 ? "!(" : "", x, x, nn == 0xA1 ? ")" : "");
+            skip(condition);
+            return;
+        case 0xF000:
+            switch (nn) {
+                case 0x07: emit("V[%u] = c.delay_timer;", x); return;
+                case 0x15: emit("c.delay_timer = V[%u];", x); return;
+                case 0x18:
+                    emit("logSoundWrite(c, base + (count - left) - %zu, V[%u]);", length - k, x);
+                    emit("c.sound_timer = V[%u];", x);
+                    return;
+                case 0x1E:
+                    emit("sum = c.I + V[%u];", x);
+                    emit("V[15] = (sum > 0x0FFF) ? 1 : 0;");
+                    emit("c.I = sum & 0x0FFF;");
+                    return;
+                case 0x29: emit("c.I = V[%u] * 5;", x); return;
+                case 0x30: emit("c.I = BIG_FONT_ADDRESS + (V[%u] & 0xF) * 10;", x); return;
+                case 0x33:
+                    emit("value = V[%u];", x);
+                    emit("writeMemory(c, c.I, value / 100);");
+                    emit("writeMemory(c, c.I + 1, (value / 10) % 10);");
+                    emit("writeMemory(c, c.I + 2, value % 10);");
+                    return;
+                case 0x55:
+                    emit("for (int i = 0; i <= %u; ++i) writeMemory(c, c.I + i, V[i]);", x);
+                    if (quirks.memoryIncrement) emit("c.I = (c.I + %u) & 0xFFF;", x + 1);
+                    return;
+                case 0x65:
+                    emit("for (int i = 0; i <= %u; ++i) V[i] = c.memory[(c.I + i) & 0xFFF];", x);
+                    if (quirks.memoryIncrement) emit("c.I = (c.I + %u) & 0xFFF;", x + 1);
+                    return;
+                case 0x75: emit("memcpy(c.rplFlags, V, %u);", x + 1); return;
+                case 0x85: emit("memcpy(V, c.rplFlags, %u);", x + 1); return;
+                case 0x80:
+                    return;
+            }
+            break;
+    }
+    // Unknown (or a VIP DXYN, which may have to wait for the next tick), let the interpreter have it
+    emit("{ pc = 0x%x; goto out; }", addr);
+}
+
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+// QuirkProfile's enumerator, as the generated code spells it
+std::string enumerator(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::Vip: return "Vip";
+        case QuirkProfile::SuperChip: return "SuperChip";
+        case QuirkProfile::XoChip: return "XoChip";
+        default: return "Modern";
+    }
+}
+
+std::string generate(const Analysis& a, const std::vector<Block>& blocks, const std::string& name) {
+    Emitted body;
+    char line[160];
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const Block& block = blocks[i];
+        size_t length = block.instructions.size();
+        // An instruction left to the interpreter ends its block, and runs there, not here
+        Flow last = flowOf(opcodeAt(a, block.instructions.back()));
+        size_t run = last == Flow::Interpret ? length - 1 : length;
+        std::snprintf(line, sizeof(line),
+                      "L%03x:\n"
+                      "    if (left < %zu || dead[%zu]) { pc = 0x%x; goto out; }\n"
+                      "    left -= %zu;\n",
+                      block.start, run, i, block.start, run);
+        body.code += line;
+        for (size_t k = 0; k < length; ++k) {
+            emitInstruction(a, block.instructions[k], k, run, body);
+        }
+        // Ran into the next block (or off the compiled code)
+        if (last == Flow::Next || last == Flow::Store) body.code += "    " + jumpTo(a, block.end) + "\n";
+    }
+
+    std::string out;
+    out += "// Generated by chip8_aotc from " + name + ", do not edit.\n\n";
+    out += "#include <cstring>\n\n#include \"aot.h\"\n#include \"chip8.h\"\n\nnamespace {\n\n";
+
+    out += "const uint8_t image[] = {";
+    for (size_t i = 0; i < a.size; ++i) {
+        std::snprintf(line, sizeof(line), "%s0x%02x,", i % 16 ? " " : "\n    ", a.memory[0x200 + i]);
+        out += line;
+    }
+    out += "\n};\n\n";
+
+    out += "const AotBlock blocks[] = {";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        std::snprintf(line, sizeof(line), "%s{ 0x%x, 0x%x },", i % 6 ? " " : "\n    ", blocks[i].start, blocks[i].end);
+        out += line;
+    }
+    out += "\n};\n\n";
+
+    out += "uint64_t run(Chip8& c, const uint8_t* dead, uint64_t count) {\n"
+           "    uint8_t* const V = c.V;\n"
+           "    const uint64_t base = c.instructionCount;\n"
+           "    uint64_t left = count;\n"
+           "    uint16_t pc = c.pc;\n"
+           "    uint16_t sum;\n"
+           "    uint8_t value;\n"
+           "    (void)V;\n"
+           "    (void)sum;\n"
+           "    (void)value;\n";
+    if (body.dispatch || body.idle) out += "dispatch:\n";
+    out += "    switch (pc) {\n";
+    for (const Block& block : blocks) {
+        std::snprintf(line, sizeof(line), "        case 0x%x: goto L%03x;\n", block.start, block.start);
+        out += line;
+    }
+    out += "    }\n    goto out;\n";
+    if (body.idle) {
+        out += "idle:\n"
+               "    c.pc = pc;\n"
+               "    c.instructionCount = base + (count - left);\n"
+               "    left -= skipIdleLoop(c, left);\n"
+               "    pc = c.pc;\n"
+               "    goto dispatch;\n";
+    }
+    out += body.code;
+    out += "out:\n"
+           "    c.pc = pc;\n"
+           "    c.instructionCount = base + (count - left);\n"
+           "    return count - left;\n"
+           "}\n\n";
+
+    out += "const AotProgram program = { " + quoted(name) +
+           ", image, sizeof(image), blocks, sizeof(blocks) / sizeof(blocks[0]), run, QuirkProfile::" +
+           enumerator(quirks.profile) + " };\n"
+           "const bool registered = registerAotProgram(&program);\n\n"
+           "} // namespace\n";
+    return out;
+}
+
+// Code with its disassembly, everything else as data bytes
+void printListing(const Analysis& a) {
+    unsigned end = 0x200 + (unsigned)a.size;
+    unsigned addr = 0x200;
+    char text[32];
+    while (addr < end) {
+        if (a.code[addr]) {
+            uint16_t opcode = opcodeAt(a, addr);
+            disassemble(opcode, text, sizeof(text));
+            std::printf("%s%03X: %04X  %s\n", a.leader[addr] ? "\n" : "", addr, opcode, text);
+            addr += 2;
+            continue;
+        }
+        std::printf("%03X: data ", addr);
+        for (int i = 0; i < 8 && addr < end && !a.code[addr]; ++i, ++addr) {
+            std::printf(" %02X", a.memory[addr]);
+        }
+        std::printf("\n");
+    }
+}
+
+// "Brix [Andreas Gustafsson, 1990]" -> "Brix_Andreas_Gustafsson_1990"
+std::string identifier(const std::string& name) {
+    std::string out;
+    for (char ch : name) {
+        bool word = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9');
+        if (word) out += ch;
+        else if (!out.empty() && out.back() != '_') out += '_';
+    }
+    while (!out.empty() && out.back() == '_') out.pop_back();
+    return out;
+}
+
+bool compileRom(const std::string& path, const std::string& outDir, bool list) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::fprintf(stderr, "Failed to open ROM: %s\n", path.c_str());
+        return false;
+    }
+    std::vector<char> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.size() > MAX_ROM_SIZE) {
+        std::fprintf(stderr, "ROM too large: %s\n", path.c_str());
+        return false;
+    }
+
+    std::unique_ptr<Analysis> analysis(new Analysis());
+    Analysis& a = *analysis;
+    memcpy(a.memory + 0x200, rom.data(), rom.size());
+    a.size = rom.size();
+    analyze(a);
+    std::vector<Block> blocks = findBlocks(a);
+
+    if (list) {
+        std::printf("%s\n", path.c_str());
+        printListing(a);
+        return true;
+    }
+
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    std::string stem = name.substr(0, name.find_last_of('.'));
+    if (quirks.profile != QuirkProfile::Modern) stem += std::string("_") + quirkProfileName(quirks.profile);
+    std::string outPath = outDir + "/aot_" + identifier(stem) + ".cpp";
+    std::ofstream out(outPath);
+    out << generate(a, blocks, name);
+    if (!out) {
+        std::fprintf(stderr, "Failed to write %s\n", outPath.c_str());
+        return false;
+    }
+
+    size_t instructions = 0, codeBytes = 0;
+    for (const Block& block : blocks) {
+        instructions += block.instructions.size();
+        codeBytes += block.end - block.start;
+    }
+    std::printf("%-48s %4zu blocks %5zu instructions, %4zu of %4zu bytes code, %d indirect jumps -> %s\n",
+                name.c_str(), blocks.size(), instructions, codeBytes, a.size, a.indirect, outPath.c_str());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> roms;
+    std::string outDir = ".";
+    bool list = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) outDir = argv[++i];
+        else if (arg == "--list") list = true;
+        else if (arg == "--quirks" && i + 1 < argc) {
+            QuirkProfile profile;
+            if (!parseQuirkProfile(argv[++i], profile)) {
+                std::fprintf(stderr, "Unknown quirk profile: %s\n", argv[i]);
+                return 1;
+            }
+            quirks = quirksOf(profile);
+        }
+        else roms.push_back(arg);
+    }
+    if (roms.empty()) {
+        std::fprintf(stderr, "usage: chip8_aotc <rom>... [-o DIR] [--quirks modern|vip|schip|xochip] [--list]\n");
+        return 1;
+    }
+
+    bool ok = true;
+    for (const auto& rom : roms) {
+        ok = compileRom(rom, outDir, list) && ok;
+    }
+    return ok ? 0 : 1;
+}
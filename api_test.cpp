@@ -0,0 +1,85 @@
+// Checks for the C API (chip8_api.h):
+//
+//   chip8_api_test [rom]
+//
+// that chip8_batch_step allocates nothing once the batch is set up, and that
+// a batch stepped across threads observes the same as one stepped on one.
+// Exit code 1 on any failure.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#include "chip8_api.h"
+
+// Every allocation in the process goes through here. delete isn't inlined,
+// or GCC sees free() on what it takes for operator new's memory and warns.
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+const size_t INSTANCES = 4096;
+const int STEPS = 100;
+
+struct Run {
+    std::vector<uint64_t> displays = std::vector<uint64_t>(INSTANCES * CHIP8_DISPLAY_WORDS);
+    std::vector<chip8_registers> registers = std::vector<chip8_registers>(INSTANCES);
+    uint64_t stepAllocations = 0;
+};
+
+static bool run(const std::vector<uint8_t>& rom, unsigned threads, Run& out) {
+    chip8_batch* batch = chip8_batch_create(INSTANCES, threads);
+    if (!batch || chip8_batch_load(batch, rom.data(), rom.size(), 1) != 0) return false;
+    chip8_batch_observe(batch, out.displays.data(), out.registers.data());
+    std::vector<uint16_t> keys(INSTANCES);
+    for (int step = 0; step < STEPS; ++step) {
+        for (size_t i = 0; i < INSTANCES; ++i) keys[i] = (uint16_t)(1u << ((i + step / 10) % 16));
+        chip8_batch_set_keys(batch, keys.data());
+        uint64_t before = allocations.load();
+        chip8_batch_step(batch, 1);
+        out.stepAllocations += allocations.load() - before;
+    }
+    chip8_batch_destroy(batch);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "roms/games/Brix [Andreas Gustafsson, 1990].ch8";
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.empty()) {
+        std::fprintf(stderr, "Failed to read ROM: %s\n", path);
+        return 1;
+    }
+
+    Run single, parallel;
+    if (!run(rom, 1, single) || !run(rom, 4, parallel)) {
+        std::fprintf(stderr, "Failed to set up a batch\n");
+        return 1;
+    }
+    int failures = 0;
+    for (const Run* r : { &single, &parallel }) {
+        bool ok = r->stepAllocations == 0;
+        std::printf("%s %d steps of %zu instances, %u threads: %llu allocations\n", ok ? "ok  " : "FAIL", STEPS,
+                    INSTANCES, r == &single ? 1u : 4u, (unsigned long long)r->stepAllocations);
+        failures += !ok;
+    }
+    bool same = single.displays == parallel.displays;
+    for (size_t i = 0; same && i < INSTANCES; ++i) {
+        same = single.registers[i].pc == parallel.registers[i].pc &&
+               single.registers[i].instruction_count == parallel.registers[i].instruction_count;
+    }
+    std::printf("%s 1 and 4 threads observe the same\n", same ? "ok  " : "FAIL");
+    failures += !same;
+    return failures ? 1 : 0;
+}
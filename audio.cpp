@@ -0,0 +1,115 @@
+#include "audio.h"
+
+#include <cstring>
+
+#include "chip8.h"
+
+SampleRing::SampleRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    buffer.resize(size);
+    mask = size - 1;
+}
+
+size_t SampleRing::push(const int16_t* samples, size_t count) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t space = buffer.size() - (h - t);
+    if (count > space) count = space;
+    for (size_t i = 0; i < count; ++i) {
+        buffer[(h + i) & mask] = samples[i];
+    }
+    head.store(h + count, std::memory_order_release);
+    return count;
+}
+
+size_t SampleRing::pop(int16_t* samples, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    if (count > h - t) count = h - t;
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = buffer[(t + i) & mask];
+    }
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+size_t SampleRing::available() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+// Append `count` samples of square wave (or silence)
+static void renderSpan(Buzzer& buzzer, bool on, size_t count, std::vector<int16_t>& out) {
+    // phase advances by `frequency` per sample and wraps at sampleRate, so the
+    // pitch is exact without floating point
+    for (size_t i = 0; i < count; ++i) {
+        int16_t level = buzzer.phase < (uint32_t)buzzer.sampleRate / 2 ? buzzer.volume : (int16_t)-buzzer.volume;
+        out.push_back(on ? level : 0);
+        buzzer.phase += buzzer.frequency;
+        if (buzzer.phase >= (uint32_t)buzzer.sampleRate) buzzer.phase -= buzzer.sampleRate;
+    }
+}
+
+void renderBuzzerFrame(Buzzer& buzzer, Chip8& chip, uint64_t frameStart, uint32_t instructions,
+                       bool soundOn, std::vector<int16_t>& out) {
+    uint64_t index = buzzer.frame % 60;
+    size_t samples = (size_t)((index + 1) * buzzer.sampleRate / 60 - index * buzzer.sampleRate / 60);
+    buzzer.frame++;
+
+    size_t done = 0;
+    for (int i = 0; i < chip.soundWriteCount; ++i) {
+        const SoundWrite& write = chip.soundWrites[i];
+        // The write takes effect at the sample where its instruction falls in the frame
+        uint64_t position = write.instruction - frameStart;
+        size_t at = instructions ? (size_t)(position * samples / instructions) : 0;
+        if (at > samples) at = samples;
+        if (at > done) {
+            renderSpan(buzzer, soundOn, at - done, out);
+            done = at;
+        }
+        soundOn = write.value > 0;
+    }
+    chip.soundWriteCount = 0;
+    // The timer tick at the end of the frame is what turns the buzzer off, so
+    // whatever state the last write left lasts the rest of the frame
+    renderSpan(buzzer, soundOn, samples - done, out);
+}
+
+// Canonical 44 byte header for mono 16-bit PCM
+static void writeWavHeader(FILE* file, int sampleRate, uint32_t samples) {
+    uint32_t dataSize = samples * 2;
+    uint32_t riffSize = 36 + dataSize;
+    uint32_t fmtSize = 16, rate = sampleRate, byteRate = sampleRate * 2;
+    uint16_t format = 1, channels = 1, blockAlign = 2, bits = 16;
+    fwrite("RIFF", 1, 4, file); fwrite(&riffSize, 4, 1, file); fwrite("WAVE", 1, 4, file);
+    fwrite("fmt ", 1, 4, file); fwrite(&fmtSize, 4, 1, file);
+    fwrite(&format, 2, 1, file); fwrite(&channels, 2, 1, file);
+    fwrite(&rate, 4, 1, file); fwrite(&byteRate, 4, 1, file);
+    fwrite(&blockAlign, 2, 1, file); fwrite(&bits, 2, 1, file);
+    fwrite("data", 1, 4, file); fwrite(&dataSize, 4, 1, file);
+}
+
+bool openWav(WavWriter& wav, const char* path, int sampleRate) {
+    wav.file = fopen(path, "wb");
+    if (!wav.file) return false;
+    wav.sampleRate = sampleRate;
+    wav.samples = 0;
+    writeWavHeader(wav.file, sampleRate, 0);
+    return !ferror(wav.file);
+}
+
+bool writeWav(WavWriter& wav, const int16_t* samples, size_t count) {
+    if (!wav.file) return false;
+    wav.samples += (uint32_t)fwrite(samples, sizeof(int16_t), count, wav.file);
+    return !ferror(wav.file);
+}
+
+bool closeWav(WavWriter& wav) {
+    if (!wav.file) return false;
+    fseek(wav.file, 0, SEEK_SET);
+    writeWavHeader(wav.file, wav.sampleRate, wav.samples);
+    bool ok = !ferror(wav.file);
+    ok = fclose(wav.file) == 0 && ok;
+    wav.file = nullptr;
+    return ok;
+}
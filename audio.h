@@ -0,0 +1,65 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+struct Chip8;
+
+// The buzzer.
+//
+// The emulation thread renders each emulated frame into samples right after
+// running it: the buzzer is on while sound_timer is non-zero, and every Fx18
+// logged in chip.soundWrites switches it at the sample matching that
+// instruction's place in the frame. Samples go to an output through a
+// lock-free SPSC ring; if the output falls behind, samples are dropped
+// rather than making the emulator wait.
+
+// Lock-free single-producer/single-consumer ring of samples
+class SampleRing {
+public:
+    explicit SampleRing(size_t capacity = 4096);
+
+    // Producer: returns how many samples fit, the rest are dropped
+    size_t push(const int16_t* samples, size_t count);
+    // Consumer: returns how many samples were available
+    size_t pop(int16_t* samples, size_t count);
+    size_t available() const;
+
+private:
+    std::vector<int16_t> buffer;
+    size_t mask;
+    std::atomic<size_t> head{0};   // written by the producer
+    std::atomic<size_t> tail{0};   // written by the consumer
+};
+
+struct Buzzer {
+    int sampleRate = 48000;
+    int frequency = 440;      // square wave pitch
+    int16_t volume = 3000;
+    uint32_t phase = 0;       // position in the square wave, carried across frames
+    uint64_t frame = 0;       // frames rendered, for spreading sampleRate/60's remainder
+};
+
+// Append the samples for the frame just run. `frameStart` is
+// chip.instructionCount and `soundOn` whether sound_timer was non-zero before
+// the frame; `instructions` is how many it ran. Clears chip.soundWrites.
+void renderBuzzerFrame(Buzzer& buzzer, Chip8& chip, uint64_t frameStart, uint32_t instructions,
+                       bool soundOn, std::vector<int16_t>& out);
+
+// Mono 16-bit WAV file output, the headless backend
+struct WavWriter {
+    FILE* file = nullptr;
+    int sampleRate = 48000;
+    uint32_t samples = 0;
+};
+
+bool openWav(WavWriter& wav, const char* path, int sampleRate);
+bool writeWav(WavWriter& wav, const int16_t* samples, size_t count);
+// Fills in the header sizes and closes the file
+bool closeWav(WavWriter& wav);
+
+#endif // AUDIO_H
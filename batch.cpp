@@ -0,0 +1,772 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "chip8.h"
+
+// The kernels are compiled for AVX2 whatever the build flags and only used
+// when the CPU has it
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CHIP8_BATCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Lanes per group: one 256-bit vector of byte registers
+const size_t GROUP = 32;
+// A step that splits a group into more (pc, opcode) partitions than this,
+// or into more than a quarter of its lanes, hands the rest of the run to the
+// lanes one by one: lockstep only pays while lanes share code
+const int MAX_PARTITIONS = 8;
+
+Batch::Batch(size_t lanes) : lanes(lanes) {
+    padded = (lanes + GROUP - 1) / GROUP * GROUP;
+    V.resize(16 * padded);
+    I.resize(padded);
+    pc.resize(padded);
+    sp.resize(padded);
+    stack.resize(16 * padded);
+    delay.resize(padded);
+    sound.resize(padded);
+    rng.resize(padded);
+    keys.resize(padded);
+    memory.resize(padded * 4096);
+    gfx.resize(padded * MAX_DISPLAY_WORDS);
+    dirtyRows.resize(padded);
+    hires.resize(padded);
+    rplFlags.resize(padded * 16);
+    vblank.resize(padded);
+    drawWait.resize(padded);
+    keyWait.resize(padded);
+    keyWaitHeld.resize(padded);
+    keyWaitPressed.resize(padded);
+    drawFlag.resize(padded);
+    instructionCount.resize(padded);
+    frames.resize(padded);
+    divergent.resize(padded / GROUP * 4);
+    rescan.resize(padded / GROUP);
+    divergeFailures.resize(padded / GROUP);
+    divergeBackoff.resize(padded / GROUP);
+}
+
+// One lane's slice of the arrays. Stepping goes through these plain
+// pointers, set up once per lane: byte stores could alias the vectors'
+// own pointers, and going through them would reload those after every one.
+struct Batch::LaneView {
+    uint8_t* V;            // V0 of the lane, registers `stride` apart
+    uint16_t* stack;       // likewise
+    size_t stride;
+    uint16_t* I;
+    uint16_t* sp;
+    uint8_t* delay;
+    uint8_t* sound;
+    uint32_t* rng;
+    const uint16_t* keys;
+    uint8_t* memory;
+    uint64_t* gfx;
+    uint64_t* dirtyRows;
+    uint8_t* hires;
+    uint8_t* rplFlags;
+    uint8_t* vblank;
+    uint8_t* drawWait;
+    uint8_t* keyWait;
+    uint16_t* keyWaitHeld;
+    uint16_t* keyWaitPressed;
+    uint8_t* drawFlag;
+    uint64_t* divergent;   // the group's bits
+
+    // Mark the block holding addr as one the group's lanes may differ in
+    void wrote(uint16_t addr) const {
+        uint16_t block = (addr & 0xFFF) >> 4;
+        divergent[block >> 6] |= 1ull << (block & 63);
+    }
+    uint16_t fetch(uint16_t pc) const {
+        return memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+    }
+    Screen screen() const {
+        return { gfx, dirtyRows, *hires != 0 };
+    }
+};
+
+Batch::LaneView Batch::view(size_t lane) {
+    return { &V[lane], &stack[lane], padded, &I[lane], &sp[lane], &delay[lane], &sound[lane], &rng[lane],
+             &keys[lane], &memory[lane * 4096], &gfx[lane * MAX_DISPLAY_WORDS], &dirtyRows[lane], &hires[lane],
+             &rplFlags[lane * 16], &vblank[lane], &drawWait[lane], &keyWait[lane], &keyWaitHeld[lane],
+             &keyWaitPressed[lane], &drawFlag[lane],
+             &divergent[lane / GROUP * 4] };
+}
+
+template <typename Q>
+uint16_t Batch::stepLane(const LaneView& l, uint16_t opcode, uint16_t p) {
+    const uint16_t nnn = opcode & 0x0FFF;
+    const uint8_t x = (opcode & 0x0F00) >> 8;
+    const uint8_t y = (opcode & 0x00F0) >> 4;
+    const uint8_t n = opcode & 0x000F;
+    const uint8_t nn = opcode & 0x00FF;
+    const size_t stride = l.stride;
+    uint8_t* const v = l.V;
+    uint8_t& vx = v[x * stride];
+    uint8_t& vy = v[y * stride];
+    uint8_t& vf = v[0xF * stride];
+    uint8_t* const mem = l.memory;
+    uint16_t& index = *l.I;
+
+    // Dense cases, so this is one jump table rather than a tree of compares
+    switch (opcode >> 12) {
+        case 0x0:
+            if (nn == 0xEE) {
+                (*l.sp)--;
+                p = l.stack[(*l.sp & 0xF) * stride] + 2;
+                break;
+            }
+            switch (nn) {
+                case 0xE0:
+                    memset(l.gfx, 0, screenWords(*l.hires) * sizeof(uint64_t));
+                    *l.dirtyRows = allRows(*l.hires);
+                    break;
+                case 0xFB: scrollRight(l.screen(), 4); break;
+                case 0xFC: scrollLeft(l.screen(), 4); break;
+                case 0xFE:
+                case 0xFF:
+                    *l.hires = nn == 0xFF;
+                    memset(l.gfx, 0, MAX_DISPLAY_WORDS * sizeof(uint64_t));
+                    *l.dirtyRows = allRows(*l.hires);
+                    break;
+                default:
+                    if (x == 0 && y == 0xC) scrollDown(l.screen(), n);
+                    else if (x == 0 && y == 0xD) scrollUp(l.screen(), n);
+                    // Unknown ones and 00FD (exit) leave pc where it is
+                    else return p;
+            }
+            *l.drawFlag = true;
+            p += 2;
+            break;
+        case 0x1: p = nnn; break;
+        case 0x2:
+            l.stack[(*l.sp & 0xF) * stride] = p;
+            (*l.sp)++;
+            p = nnn;
+            break;
+        case 0x3: p += vx == nn ? 4 : 2; break;
+        case 0x4: p += vx != nn ? 4 : 2; break;
+        case 0x5: p += n == 0 && vx == vy ? 4 : 2; break;
+        case 0x6: vx = nn; p += 2; break;
+        case 0x7: vx += nn; p += 2; break;
+        case 0x8:
+            switch (n) {
+                case 0x0: vx = vy; break;
+                case 0x1: vx |= vy; if (Q::vfReset) vf = 0; break;
+                case 0x2: vx &= vy; if (Q::vfReset) vf = 0; break;
+                case 0x3: vx ^= vy; if (Q::vfReset) vf = 0; break;
+                case 0x4: vx = vx + vy; vf = vy > vx ? 1 : 0; break;
+                case 0x5: vf = vx >= vy ? 1 : 0; vx = vx - vy; break;
+                case 0x6: {
+                    uint8_t& from = Q::shiftVy ? vy : vx;
+                    vf = from & 0x1;
+                    vx = from >> 1;
+                    break;
+                }
+                case 0x7: vf = vy > vx ? 1 : 0; vx = vy - vx; break;
+                case 0xE: {
+                    uint8_t& from = Q::shiftVy ? vy : vx;
+                    vf = (from & 0x80) ? 1 : 0;
+                    vx = from << 1;
+                    break;
+                }
+            }
+            p += 2;
+            break;
+        case 0x9: p += n == 0 && vx != vy ? 4 : 2; break;
+        case 0xA: index = nnn; p += 2; break;
+        case 0xB: p = nnn + v[Q::jumpVx ? x * stride : 0]; break;
+        case 0xC: {
+            uint32_t& r = *l.rng;
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            vx = (r >> 24) & nn;
+            p += 2;
+            break;
+        }
+        case 0xD:
+            // See opDRW for the VIP's wait
+            if (Q::displayWait && *l.drawWait) {
+                if (!*l.vblank) break;
+                *l.drawWait = false;
+                p += 2;
+                break;
+            }
+            vf = drawSprite<Q::wrap>(l.screen(), mem, index, vx, vy, n) ? 1 : 0;
+            *l.drawFlag = true;
+            if (Q::displayWait) {
+                *l.drawWait = true;
+                *l.vblank = false;
+                break;
+            }
+            p += 2;
+            break;
+        case 0xE: {
+            bool pressed = vx < 16 && (*l.keys >> vx & 1);
+            if (nn == 0xA1) p += pressed ? 2 : 4;
+            else p += pressed ? 4 : 2;
+            break;
+        }
+        case 0xF:
+            switch (nn) {
+                case 0x07: vx = *l.delay; break;
+                case 0x0A: {
+                    // See opKEY. A waiting lane runs it again every step rather than parking.
+                    const uint16_t down = *l.keys;
+                    if (!*l.keyWait) {
+                        *l.keyWait = true;
+                        *l.keyWaitHeld = down;
+                        *l.keyWaitPressed = 0;
+                    }
+                    *l.keyWaitHeld &= down;
+                    *l.keyWaitPressed |= down & ~*l.keyWaitHeld;
+                    const uint16_t released = *l.keyWaitPressed & ~down;
+                    if (!released) return p;
+                    vx = (uint8_t)__builtin_ctz(released);
+                    *l.keyWait = false;
+                    break;
+                }
+                case 0x15: *l.delay = vx; break;
+                case 0x18: *l.sound = vx; break;
+                case 0x1E: {
+                    uint16_t sum = index + vx;
+                    vf = sum > 0x0FFF ? 1 : 0;
+                    index = sum & 0x0FFF;
+                    break;
+                }
+                case 0x29: index = vx * 5; break;
+                case 0x30: index = BIG_FONT_ADDRESS + (vx & 0xF) * 10; break;
+                case 0x33: {
+                    uint8_t value = vx;
+                    mem[index & 0xFFF] = value / 100;
+                    mem[(index + 1) & 0xFFF] = (value / 10) % 10;
+                    mem[(index + 2) & 0xFFF] = value % 10;
+                    for (int i = 0; i < 3; ++i) {
+                        l.wrote(index + i);
+                    }
+                    break;
+                }
+                case 0x55:
+                    for (int i = 0; i <= x; ++i) {
+                        mem[(index + i) & 0xFFF] = v[i * stride];
+                        l.wrote(index + i);
+                    }
+                    if (Q::memoryIncrement) index = (index + x + 1) & 0xFFF;
+                    break;
+                case 0x65:
+                    for (int i = 0; i <= x; ++i) {
+                        v[i * stride] = mem[(index + i) & 0xFFF];
+                    }
+                    if (Q::memoryIncrement) index = (index + x + 1) & 0xFFF;
+                    break;
+                case 0x75:
+                    for (int i = 0; i <= x; ++i) {
+                        l.rplFlags[i] = v[i * stride];
+                    }
+                    break;
+                case 0x85:
+                    for (int i = 0; i <= x; ++i) {
+                        v[i * stride] = l.rplFlags[i];
+                    }
+                    break;
+                default:
+                    // Unknown Fxxx leaves pc where it is (FF80 is a NOP)
+                    if (nn != 0x80) p -= 2;
+            }
+            p += 2;
+            break;
+    }
+    return p;
+}
+
+void Batch::load(size_t lane, const Chip8& chip) {
+    for (int r = 0; r < 16; ++r) {
+        V[r * padded + lane] = chip.V[r];
+        stack[r * padded + lane] = chip.stack[r];
+    }
+    I[lane] = chip.I;
+    pc[lane] = chip.pc;
+    sp[lane] = chip.sp;
+    delay[lane] = chip.delay_timer;
+    sound[lane] = chip.sound_timer;
+    rng[lane] = chip.rng;
+    uint16_t pressed = 0;
+    for (int k = 0; k < 16; ++k) {
+        if (chip.keypad[k] == 1) pressed |= 1 << k;
+    }
+    keys[lane] = pressed;
+    memcpy(&memory[lane * 4096], chip.memory, 4096);
+    memcpy(&gfx[lane * MAX_DISPLAY_WORDS], chip.gfx, sizeof(chip.gfx));
+    dirtyRows[lane] = chip.dirtyRows;
+    hires[lane] = chip.hires;
+    memcpy(&rplFlags[lane * 16], chip.rplFlags, sizeof(chip.rplFlags));
+    vblank[lane] = chip.vblank;
+    drawWait[lane] = chip.drawWait;
+    keyWait[lane] = chip.keyWait;
+    keyWaitHeld[lane] = chip.keyWaitHeld;
+    keyWaitPressed[lane] = chip.keyWaitPressed;
+    quirks = chip.quirks;
+    vfReset = withQuirks(quirks, [](auto q) { return decltype(q)::vfReset; });
+    shiftVy = withQuirks(quirks, [](auto q) { return decltype(q)::shiftVy; });
+    drawFlag[lane] = chip.drawFlag;
+    instructionCount[lane] = chip.instructionCount;
+    frames[lane] = chip.frames;
+    rescan[lane / GROUP] = true;
+}
+
+void Batch::store(size_t lane, Chip8& chip) const {
+    for (int r = 0; r < 16; ++r) {
+        chip.V[r] = V[r * padded + lane];
+        chip.stack[r] = stack[r * padded + lane];
+    }
+    chip.I = I[lane];
+    chip.pc = pc[lane];
+    chip.sp = sp[lane];
+    chip.delay_timer = delay[lane];
+    chip.sound_timer = sound[lane];
+    chip.soundWriteCount = 0;
+    chip.rng = rng[lane];
+    for (int k = 0; k < 16; ++k) {
+        chip.keypad[k] = (keys[lane] >> k) & 1;
+    }
+    memcpy(chip.memory, &memory[lane * 4096], 4096);
+    memcpy(chip.gfx, &gfx[lane * MAX_DISPLAY_WORDS], sizeof(chip.gfx));
+    chip.dirtyRows = dirtyRows[lane];
+    chip.hires = hires[lane] != 0;
+    memcpy(chip.rplFlags, &rplFlags[lane * 16], sizeof(chip.rplFlags));
+    chip.vblank = vblank[lane] != 0;
+    chip.drawWait = drawWait[lane] != 0;
+    chip.keyWait = keyWait[lane] != 0;
+    chip.keyWaitHeld = keyWaitHeld[lane];
+    chip.keyWaitPressed = keyWaitPressed[lane];
+    chip.quirks = quirks;
+    chip.drawFlag = drawFlag[lane];
+    chip.instructionCount = instructionCount[lane];
+    chip.frames = frames[lane];
+    // Memory was replaced wholesale
+    invalidateDecodeCache(chip);
+}
+
+void Batch::setKeys(size_t lane, uint16_t pressed) {
+    keys[lane] = pressed;
+}
+
+void Batch::observe(size_t lane, uint64_t* display, LaneRegisters* registers) const {
+    if (display) memcpy(display, &gfx[lane * MAX_DISPLAY_WORDS], screenWords(hires[lane]) * sizeof(uint64_t));
+    if (!registers) return;
+    for (int r = 0; r < 16; ++r) {
+        registers->V[r] = V[r * padded + lane];
+    }
+    registers->I = I[lane];
+    registers->pc = pc[lane];
+    registers->sp = sp[lane];
+    registers->delay = delay[lane];
+    registers->sound = sound[lane];
+    registers->hires = hires[lane];
+    registers->instructionCount = instructionCount[lane];
+    registers->frames = frames[lane];
+}
+
+// Recheck the group's divergent blocks (all of them after a load): ones the
+// lanes have since written identically are shared again
+void Batch::scanDivergence(size_t group) {
+    size_t live = lanes - group < GROUP ? lanes - group : GROUP;
+    uint64_t* bits = &divergent[group / GROUP * 4];
+    bool all = rescan[group / GROUP];
+    rescan[group / GROUP] = false;
+    for (int word = 0; word < 4; ++word) {
+        uint64_t check = all ? ~0ull : bits[word];
+        for (; check; check &= check - 1) {
+            int block = word * 64 + __builtin_ctzll(check);
+            const uint8_t* first = &memory[group * 4096 + block * 16];
+            bool same = true;
+            for (size_t lane = 1; lane < live && same; ++lane) {
+                same = memcmp(first, first + lane * 4096, 16) == 0;
+            }
+            if (same) bits[word] &= ~(1ull << (block & 63));
+            else bits[word] |= 1ull << (block & 63);
+        }
+    }
+}
+
+uint32_t Batch::activeLanes(size_t group) const {
+    size_t live = lanes - group < GROUP ? lanes - group : GROUP;
+    return live == 32 ? 0xFFFFFFFF : (1u << live) - 1;
+}
+
+void Batch::run(uint64_t count) {
+    // Each group runs the whole count before the next starts, so its lanes
+    // stay in cache
+    for (size_t group = 0; group < padded; group += GROUP) {
+        scanDivergence(group);
+        runGroup(group, count);
+    }
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        instructionCount[lane] += count;
+    }
+}
+
+void Batch::tickLane(size_t lane) {
+    vblank[lane] = 1;
+    if (delay[lane] > 0) delay[lane]--;
+    if (sound[lane] > 0) sound[lane]--;
+    frames[lane]++;
+}
+
+void Batch::tickTimers() {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        tickLane(lane);
+    }
+}
+
+void Batch::runFrames(uint32_t instructions, uint64_t count) {
+    for (size_t group = 0; group < padded; group += GROUP) {
+        uint32_t active = activeLanes(group);
+        uint16_t& backoff = divergeBackoff[group / GROUP];
+        uint64_t frame = 0;
+        while (frame < count) {
+            if (active == 1 || backoff) {
+                // Lane by lane, each lane can stay in cache for all of its frames
+                uint64_t run = active == 1 ? count - frame : std::min<uint64_t>(backoff, count - frame);
+                runLanes(group, instructions, run, true);
+                if (active != 1) backoff -= run;
+                frame += run;
+                continue;
+            }
+            scanDivergence(group);
+            runGroup(group, instructions);
+            for (uint32_t m = active; m; m &= m - 1) {
+                tickLane(group + __builtin_ctz(m));
+            }
+            frame++;
+        }
+    }
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        instructionCount[lane] += instructions * count;
+    }
+}
+
+void Batch::runLanes(size_t group, uint64_t instructions, uint64_t count, bool tick) {
+    withQuirks(quirks, [&](auto q) { runLanesFor<decltype(q)>(group, instructions, count, tick); });
+}
+
+template <typename Q>
+void Batch::runLanesFor(size_t group, uint64_t instructions, uint64_t count, bool tick) {
+    for (uint32_t m = activeLanes(group); m; m &= m - 1) {
+        size_t lane = group + __builtin_ctz(m);
+        const LaneView l = view(lane);
+        uint16_t next = pc[lane];
+        for (uint64_t frame = 0; frame < count; ++frame) {
+            for (uint64_t i = 0; i < instructions; ++i) {
+                next = stepLane<Q>(l, l.fetch(next), next);
+            }
+            if (tick) tickLane(lane);
+        }
+        pc[lane] = next;
+    }
+}
+
+void Batch::runGroup(size_t group, uint64_t count) {
+    uint32_t active = activeLanes(group);
+    uint8_t& failures = divergeFailures[group / GROUP];
+    uint16_t& backoff = divergeBackoff[group / GROUP];
+    // A lone lane has nothing to share, and groups that keep diverging back
+    // off exponentially before trying lockstep again
+    if (active == 1 || backoff) {
+        if (backoff) backoff--;
+        runLanes(group, count, 1, false);
+        return;
+    }
+    int limit = std::min(MAX_PARTITIONS, std::max(1, __builtin_popcount(active) / 4));
+    for (uint64_t i = 0; i < count; ++i) {
+        if (stepGroup(group, active) > limit) {
+            // Diverged: the lanes are independent, so finish them one at a time
+            runLanes(group, count - i - 1, 1, false);
+            if (failures < 6) failures++;
+            backoff = (uint16_t)((1u << failures) - 1);
+            return;
+        }
+    }
+    failures = 0;
+}
+
+// One instruction on every active lane of a group: lanes are partitioned by
+// (pc, opcode), each partition runs as a vector kernel if there is one.
+// Returns the number of partitions.
+int Batch::stepGroup(size_t group, uint32_t active) {
+    uint32_t pending = active;
+    int partitions = 0;
+    while (pending) {
+        partitions++;
+        size_t leader = group + __builtin_ctz(pending);
+        uint16_t leaderPc = pc[leader];
+        uint16_t opcode = fetch(leader, leaderPc);
+
+        uint32_t same = lanesAt(group, leaderPc) & pending;
+        if (mayDiverge(group, leaderPc) || mayDiverge(group, leaderPc + 1)) {
+            for (uint32_t m = same; m; m &= m - 1) {
+                if (fetch(group + __builtin_ctz(m), leaderPc) != opcode) same &= ~(m & -m);
+            }
+        }
+        pending &= ~same;
+
+        if ((same & (same - 1)) && stepVector(group, same, opcode, leaderPc)) {
+            vectorSteps += __builtin_popcount(same);
+            continue;
+        }
+        withQuirks(quirks, [&](auto q) {
+            for (uint32_t m = same; m; m &= m - 1) {
+                size_t lane = group + __builtin_ctz(m);
+                pc[lane] = stepLane<decltype(q)>(view(lane), opcode, leaderPc);
+            }
+        });
+    }
+    return partitions;
+}
+
+
+#if CHIP8_BATCH_AVX2
+
+namespace {
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Byte mask with 0xFF in every lane whose bit is set
+AVX2 __m256i expandMask(uint32_t mask) {
+    const __m256i spread = _mm256_setr_epi64x(0x0000000000000000, 0x0101010101010101,
+                                              0x0202020202020202, 0x0303030303030303);
+    const __m256i bits = _mm256_set1_epi64x((int64_t)0x8040201008040201ULL);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)mask), spread);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+}
+
+// Unsigned byte compares
+AVX2 __m256i greaterEqual(__m256i a, __m256i b) {
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a);
+}
+AVX2 __m256i greater(__m256i a, __m256i b) {
+    return _mm256_andnot_si256(_mm256_cmpeq_epi8(a, b), greaterEqual(a, b));
+}
+AVX2 __m256i notMask(__m256i m) {
+    return _mm256_xor_si256(m, _mm256_set1_epi8(-1));
+}
+
+// 16-bit lanes 0-15 and 16-31 of a byte vector, zero-extended (values) or
+// sign-extended (masks)
+AVX2 __m256i low16(__m256i v) { return _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)); }
+AVX2 __m256i high16(__m256i v) { return _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)); }
+AVX2 __m256i lowMask16(__m256i m) { return _mm256_cvtepi8_epi16(_mm256_castsi256_si128(m)); }
+AVX2 __m256i highMask16(__m256i m) { return _mm256_cvtepi8_epi16(_mm256_extracti128_si256(m, 1)); }
+
+// Two vectors of 16-bit masks back into one byte mask, in lane order
+AVX2 __m256i packMask16(__m256i lo, __m256i hi) {
+    return _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+}
+
+// A group's slice of the arrays, with writes limited to the lanes being stepped
+struct Lanes {
+    uint8_t* V;          // V of lane 0 of the group, registers `stride` apart
+    size_t stride;
+    uint16_t* I;
+    uint16_t* pc;
+    uint8_t* delay;
+    uint8_t* sound;
+    __m256i m8, m16lo, m16hi;
+
+    uint8_t* reg(int r) const { return V + r * stride; }
+    AVX2 __m256i load8(const uint8_t* p) const { return _mm256_loadu_si256((const __m256i*)p); }
+    AVX2 void store8(uint8_t* p, __m256i v) const {
+        _mm256_storeu_si256((__m256i*)p, _mm256_blendv_epi8(load8(p), v, m8));
+    }
+    AVX2 __m256i load16(const uint16_t* p) const { return _mm256_loadu_si256((const __m256i*)p); }
+    AVX2 void store16(uint16_t* p, __m256i lo, __m256i hi) const {
+        _mm256_storeu_si256((__m256i*)p, _mm256_blendv_epi8(load16(p), lo, m16lo));
+        _mm256_storeu_si256((__m256i*)(p + 16), _mm256_blendv_epi8(load16(p + 16), hi, m16hi));
+    }
+    // Every lane is at the same pc, so a skip is `next` (pc + 2), plus 2
+    // where `skip` is set
+    AVX2 void skipIf(__m256i next, __m256i skip) const {
+        const __m256i two = _mm256_set1_epi16(2);
+        store16(pc, _mm256_add_epi16(next, _mm256_and_si256(lowMask16(skip), two)),
+                    _mm256_add_epi16(next, _mm256_and_si256(highMask16(skip), two)));
+    }
+};
+
+AVX2 bool stepLanes(Lanes& l, uint32_t mask, uint16_t opcode, uint16_t leaderPc) {
+    const uint8_t n = opcode & 0x000F;
+    const uint8_t nn = opcode & 0x00FF;
+    uint8_t* vx = l.reg((opcode & 0x0F00) >> 8);
+    uint8_t* vy = l.reg((opcode & 0x00F0) >> 4);
+    uint8_t* vf = l.reg(0xF);
+
+    l.m8 = expandMask(mask);
+    l.m16lo = lowMask16(l.m8);
+    l.m16hi = highMask16(l.m8);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i next = _mm256_set1_epi16((short)(uint16_t)(leaderPc + 2));
+
+    // Operands are reloaded after every store, in the handlers' order, so
+    // x == y or x == F alias exactly as they do in the interpreter
+    switch (opcode & 0xF000) {
+        case 0x1000: {
+            __m256i target = _mm256_set1_epi16((short)(opcode & 0x0FFF));
+            l.store16(l.pc, target, target);
+            return true;
+        }
+        case 0x3000:
+            l.skipIf(next, _mm256_cmpeq_epi8(l.load8(vx), _mm256_set1_epi8((char)nn)));
+            return true;
+        case 0x4000:
+            l.skipIf(next, notMask(_mm256_cmpeq_epi8(l.load8(vx), _mm256_set1_epi8((char)nn))));
+            return true;
+        case 0x5000:
+            if (n != 0) return false;
+            l.skipIf(next, _mm256_cmpeq_epi8(l.load8(vx), l.load8(vy)));
+            return true;
+        case 0x9000:
+            if (n != 0) return false;
+            l.skipIf(next, notMask(_mm256_cmpeq_epi8(l.load8(vx), l.load8(vy))));
+            return true;
+        case 0x6000:
+            l.store8(vx, _mm256_set1_epi8((char)nn));
+            break;
+        case 0x7000:
+            l.store8(vx, _mm256_add_epi8(l.load8(vx), _mm256_set1_epi8((char)nn)));
+            break;
+        case 0x8000:
+            switch (n) {
+                case 0x0: l.store8(vx, l.load8(vy)); break;
+                case 0x1: l.store8(vx, _mm256_or_si256(l.load8(vx), l.load8(vy))); break;
+                case 0x2: l.store8(vx, _mm256_and_si256(l.load8(vx), l.load8(vy))); break;
+                case 0x3: l.store8(vx, _mm256_xor_si256(l.load8(vx), l.load8(vy))); break;
+                case 0x4:
+                    l.store8(vx, _mm256_add_epi8(l.load8(vx), l.load8(vy)));
+                    l.store8(vf, _mm256_and_si256(greater(l.load8(vy), l.load8(vx)), one));
+                    break;
+                case 0x5:
+                    l.store8(vf, _mm256_and_si256(greaterEqual(l.load8(vx), l.load8(vy)), one));
+                    l.store8(vx, _mm256_sub_epi8(l.load8(vx), l.load8(vy)));
+                    break;
+                case 0x6:
+                    l.store8(vf, _mm256_and_si256(l.load8(vx), one));
+                    l.store8(vx, _mm256_and_si256(_mm256_srli_epi16(l.load8(vx), 1), _mm256_set1_epi8(0x7F)));
+                    break;
+                case 0x7:
+                    l.store8(vf, _mm256_and_si256(greater(l.load8(vy), l.load8(vx)), one));
+                    l.store8(vx, _mm256_sub_epi8(l.load8(vy), l.load8(vx)));
+                    break;
+                case 0xE:
+                    // Bit 7 of each byte, shifting 16-bit lanes doesn't mix bytes up here
+                    l.store8(vf, _mm256_and_si256(_mm256_srli_epi16(l.load8(vx), 7), one));
+                    l.store8(vx, _mm256_add_epi8(l.load8(vx), l.load8(vx)));
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case 0xA000: {
+            __m256i value = _mm256_set1_epi16((short)(opcode & 0x0FFF));
+            l.store16(l.I, value, value);
+            break;
+        }
+        case 0xF000:
+            switch (nn) {
+                case 0x07: l.store8(vx, l.load8(l.delay)); break;
+                case 0x15: l.store8(l.delay, l.load8(vx)); break;
+                case 0x18: l.store8(l.sound, l.load8(vx)); break;
+                case 0x1E: {
+                    __m256i v = l.load8(vx);
+                    __m256i lo = _mm256_add_epi16(l.load16(l.I), low16(v));
+                    __m256i hi = _mm256_add_epi16(l.load16(l.I + 16), high16(v));
+                    const __m256i page = _mm256_set1_epi16((short)0xF000);
+                    const __m256i zero = _mm256_setzero_si256();
+                    __m256i inLo = _mm256_cmpeq_epi16(_mm256_and_si256(lo, page), zero);
+                    __m256i inHi = _mm256_cmpeq_epi16(_mm256_and_si256(hi, page), zero);
+                    l.store8(vf, _mm256_andnot_si256(packMask16(inLo, inHi), one));
+                    const __m256i address = _mm256_set1_epi16(0x0FFF);
+                    l.store16(l.I, _mm256_and_si256(lo, address), _mm256_and_si256(hi, address));
+                    break;
+                }
+                case 0x29: {
+                    __m256i v = l.load8(vx);
+                    const __m256i five = _mm256_set1_epi16(5);
+                    l.store16(l.I, _mm256_mullo_epi16(low16(v), five), _mm256_mullo_epi16(high16(v), five));
+                    break;
+                }
+                default:
+                    return false;
+            }
+            break;
+        default:
+            // Memory, display, stack, keys and CXNN go lane by lane
+            return false;
+    }
+    l.store16(l.pc, next, next);
+    return true;
+}
+
+AVX2 uint32_t matchPc(const uint16_t* pcs, uint16_t pc) {
+    const __m256i target = _mm256_set1_epi16((short)pc);
+    __m256i lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)pcs), target);
+    __m256i hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(pcs + 16)), target);
+    return (uint32_t)_mm256_movemask_epi8(packMask16(lo, hi));
+}
+
+const bool hasAvx2 = __builtin_cpu_supports("avx2");
+
+} // namespace
+
+uint32_t Batch::lanesAt(size_t group, uint16_t at) const {
+    if (hasAvx2) return matchPc(&pc[group], at);
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+        if (pc[group + i] == at) mask |= 1u << i;
+    }
+    return mask;
+}
+
+bool Batch::simd() {
+    return hasAvx2;
+}
+
+bool Batch::stepVector(size_t group, uint32_t mask, uint16_t opcode, uint16_t leaderPc) {
+    if (!hasAvx2) return false;
+    // The kernels do 8XY? the Modern way
+    if ((opcode & 0xF000) == 0x8000) {
+        uint8_t n = opcode & 0xF;
+        if (vfReset && n >= 0x1 && n <= 0x3) return false;
+        if (shiftVy && (n == 0x6 || n == 0xE)) return false;
+    }
+    Lanes l;
+    l.V = &V[group];
+    l.stride = padded;
+    l.I = &I[group];
+    l.pc = &pc[group];
+    l.delay = &delay[group];
+    l.sound = &sound[group];
+    return stepLanes(l, mask, opcode, leaderPc);
+}
+
+#else
+
+bool Batch::simd() {
+    return false;
+}
+
+uint32_t Batch::lanesAt(size_t group, uint16_t at) const {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+        if (pc[group + i] == at) mask |= 1u << i;
+    }
+    return mask;
+}
+
+bool Batch::stepVector(size_t, uint32_t, uint16_t, uint16_t) {
+    return false;
+}
+
+#endif
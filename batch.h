@@ -0,0 +1,131 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "quirks.h"
+
+struct Chip8;
+
+// A lane's registers as observe() writes them. Laid out like the C API's
+// chip8_registers (chip8_api.h), so it can write straight into its callers'
+// arrays.
+struct LaneRegisters {
+    uint8_t V[16];
+    uint16_t I, pc, sp;
+    uint8_t delay, sound;
+    uint8_t hires;
+    uint8_t reserved[7];
+    uint64_t instructionCount;
+    uint64_t frames;
+};
+
+// Lockstep batch engine.
+//
+// Runs many machines at once for bulk work (ROM search, mass regression)
+// where throughput across machines matters more than the speed of any one.
+// Registers, I, pc and timers are kept as structure-of-arrays, one array per
+// field with a slot per lane, and lanes are stepped in groups of 32: lanes of
+// a group that sit on the same pc with the same opcode execute it together
+// as one AVX2 kernel, the rest (and anything touching memory, the display,
+// the stack or keys) one lane at a time. Every lane ends up exactly where
+// runCycles would have taken it. On CPUs without AVX2 every lane steps on
+// its own, with the same results.
+class Batch {
+public:
+    explicit Batch(size_t lanes);
+
+    size_t size() const { return lanes; }
+    // Copy a machine into a lane, or a lane back out into a machine (which
+    // keeps its Jit, profiler and trace attachments). Lanes share one quirk
+    // profile, that of the machine loaded last.
+    void load(size_t lane, const Chip8& chip);
+    void store(size_t lane, Chip8& chip) const;
+    // Keypad state as a bit per key
+    void setKeys(size_t lane, uint16_t keys);
+    // Read a lane out without a Chip8 to store() it into, e.g. every frame:
+    // its registers and the display words in use (see Screen). Either may
+    // be null.
+    void observe(size_t lane, uint64_t* display, LaneRegisters* registers) const;
+
+    // Execute `count` instructions on every lane
+    void run(uint64_t count);
+    // Decrement every lane's timers, the batch version of tickTimers
+    void tickTimers();
+    // `frames` frames of `instructions` instructions and a timer tick each,
+    // the batch version of runFrame. Much faster than calling run and
+    // tickTimers per frame for big batches: each group of lanes runs all
+    // the frames while its memory is in cache.
+    void runFrames(uint32_t instructions, uint64_t frames = 1);
+
+    // Lane-instructions executed by the vector kernels, out of lanes * count
+    uint64_t vectorized() const { return vectorSteps; }
+    // Whether the AVX2 kernels are in use on this machine
+    static bool simd();
+
+private:
+    uint32_t activeLanes(size_t group) const;
+    void tickLane(size_t lane);
+    void runGroup(size_t group, uint64_t count);
+    // Each lane of the group on its own: `count` times `instructions`
+    // instructions, each followed by a timer tick if `tick` is set
+    void runLanes(size_t group, uint64_t instructions, uint64_t count, bool tick);
+    template <typename Q>
+    void runLanesFor(size_t group, uint64_t instructions, uint64_t count, bool tick);
+    int stepGroup(size_t group, uint32_t active);
+    uint32_t lanesAt(size_t group, uint16_t pc) const;
+    void scanDivergence(size_t group);
+    bool mayDiverge(size_t group, uint16_t addr) const {
+        uint16_t block = (addr & 0xFFF) >> 4;
+        return divergent[group / 32 * 4 + (block >> 6)] >> (block & 63) & 1;
+    }
+    // One lane's slice of the arrays, see batch.cpp
+    struct LaneView;
+    LaneView view(size_t lane);
+    // The interpreter's handlers on one lane, for quirk profile Q: executes
+    // `opcode` at `pc` and returns the next pc, which the caller stores
+    template <typename Q>
+    static uint16_t stepLane(const LaneView& lane, uint16_t opcode, uint16_t pc);
+    bool stepVector(size_t group, uint32_t mask, uint16_t opcode, uint16_t pc);
+    uint16_t fetch(size_t lane, uint16_t pc) const {
+        const uint8_t* mem = &memory[lane * 4096];
+        return mem[pc & 0xFFF] << 8 | mem[(pc + 1) & 0xFFF];
+    }
+
+    size_t lanes;
+    size_t padded;                 // lanes rounded up to whole groups
+    // Per-register arrays: V[r * padded + lane], stack[s * padded + lane]
+    std::vector<uint8_t> V;
+    std::vector<uint16_t> I, pc, sp, stack;
+    std::vector<uint8_t> delay, sound;
+    std::vector<uint32_t> rng;
+    std::vector<uint16_t> keys;
+    // Per-lane blocks: memory[lane * 4096 + addr], gfx[lane * MAX_DISPLAY_WORDS + word],
+    // rplFlags[lane * 16 + r]
+    std::vector<uint8_t> memory;
+    std::vector<uint64_t> gfx;
+    std::vector<uint64_t> dirtyRows;
+    std::vector<uint8_t> hires;
+    std::vector<uint8_t> rplFlags;
+    std::vector<uint8_t> vblank, drawWait;
+    std::vector<uint8_t> keyWait;
+    std::vector<uint16_t> keyWaitHeld, keyWaitPressed;
+    std::vector<uint8_t> drawFlag;
+    std::vector<uint64_t> instructionCount, frames;
+    // Per group, a bit per 16 bytes of memory that may differ between its
+    // lanes; where none do, the leader's opcode is every lane's
+    std::vector<uint64_t> divergent;
+    std::vector<uint8_t> rescan;   // per group, set when load() changed a lane
+    // Per group, like Chip8::idleFailures/idleBackoff: consecutive runs that
+    // diverged, and runs left to go lane by lane before trying lockstep again
+    std::vector<uint8_t> divergeFailures;
+    std::vector<uint16_t> divergeBackoff;
+    uint64_t vectorSteps = 0;
+    QuirkProfile quirks = QuirkProfile::Modern;
+    // The profile's 8XY? differ from the vector kernels'
+    bool vfReset = false, shiftVy = false;
+};
+
+#endif // BATCH_H
@@ -0,0 +1,304 @@
+#include "broadcast.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Socket buffers for the stream, either end: a handful of frames, so
+// a spectator that falls behind starts skipping frames instead of the
+// kernel queueing seconds of them
+static const int STREAM_BUFFER = 4096;
+
+int openBroadcastSocket(const std::string& address, bool listen) {
+    int fd = -1;
+    int result = -1;
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Bad socket path: " << path << std::endl;
+            return -1;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &STREAM_BUFFER, sizeof(STREAM_BUFFER));
+        if (listen) {
+            unlink(path.c_str()); // left over from a server that didn't shut down
+            result = bind(fd, (sockaddr*)&addr, sizeof(addr));
+        } else {
+            result = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        }
+    } else {
+        std::string host = "127.0.0.1", port = address;
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos) {
+            host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)std::strtoul(port.c_str(), nullptr, 10));
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            std::cerr << "Bad address: " << address << std::endl;
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &STREAM_BUFFER, sizeof(STREAM_BUFFER));
+        if (listen) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            result = bind(fd, (sockaddr*)&addr, sizeof(addr));
+        } else {
+            result = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        }
+    }
+    if (result == 0 && listen) result = ::listen(fd, 16);
+    if (result != 0) {
+        std::cerr << (listen ? "Can't listen on " : "Can't connect to ") << address << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool decodeBroadcast(BroadcastView& view, const BroadcastHeader& header, const uint8_t* payload) {
+    const size_t bytes = screenWords(header.hires) * sizeof(uint64_t);
+    if (header.type == BROADCAST_KEYFRAME) {
+        if (header.size != bytes) return false;
+        memcpy(view.key, payload, bytes);
+        memcpy(view.gfx, payload, bytes);
+        view.hires = header.hires;
+        view.haveKey = true;
+        view.frame = header.frame;
+        return true;
+    }
+    if (header.type != BROADCAST_DELTA || !view.haveKey || view.hires != (bool)header.hires || header.size < 8) {
+        return false;
+    }
+
+    // The changed rows' bytes, back to back, XORed onto the keyframe's
+    const size_t rowBytes = bytes / screenHeight(header.hires);
+    uint64_t rows;
+    memcpy(&rows, payload, sizeof(rows));
+    memcpy(view.gfx, view.key, bytes);
+    uint8_t* out = (uint8_t*)view.gfx;
+    size_t row = 0, column = 0;
+    auto advance = [&]() {
+        // Next byte of the next changed row
+        while (row < 64 && !(rows >> row & 1)) row++;
+        return row < 64;
+    };
+    size_t i = 8;
+    while (i + 2 <= header.size) {
+        uint8_t skip = payload[i], count = payload[i + 1];
+        i += 2;
+        if (i + count > header.size) return false;
+        for (int n = 0; n < skip + count; ++n) {
+            if (!advance() || row * rowBytes >= bytes) return false;
+            if (n >= skip) out[row * rowBytes + column] ^= payload[i++];
+            if (++column == rowBytes) {
+                column = 0;
+                row++;
+            }
+        }
+    }
+    view.frame = header.frame;
+    return i == header.size;
+}
+
+BroadcastServer::BroadcastServer(uint32_t keyframeInterval) : interval(keyframeInterval ? keyframeInterval : 1) {
+}
+
+BroadcastServer::~BroadcastServer() {
+    stop();
+}
+
+bool BroadcastServer::start(const std::string& address) {
+    stop();
+    listenFd = openBroadcastSocket(address, true);
+    if (listenFd < 0) return false;
+    if (pipe(wakeFds) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    socketPath = address.compare(0, 5, "unix:") == 0 ? address.substr(5) : std::string();
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+    haveKey = false;
+    keyMessage.reset();
+    latest.reset();
+    running = true;
+    thread = std::thread(&BroadcastServer::serverLoop, this);
+    return true;
+}
+
+void BroadcastServer::stop() {
+    if (!running) return;
+    running = false;
+    char wake = 0;
+    (void)!write(wakeFds[1], &wake, 1);
+    if (thread.joinable()) thread.join();
+    for (Client& client : clientList) close(client.fd);
+    clientList.clear();
+    clientCount = 0;
+    close(listenFd);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+    listenFd = wakeFds[0] = wakeFds[1] = -1;
+    if (!socketPath.empty()) unlink(socketPath.c_str());
+}
+
+void BroadcastServer::publish(const uint64_t* gfx, bool hires, uint64_t number) {
+    if (!running.load(std::memory_order_relaxed)) return;
+    Snapshot& snapshot = snapshots.back();
+    memcpy(snapshot.gfx, gfx, screenWords(hires) * sizeof(uint64_t));
+    snapshot.hires = hires;
+    snapshot.number = number;
+    snapshots.publish();
+    // A full pipe already has a wakeup in it
+    char wake = 0;
+    (void)!write(wakeFds[1], &wake, 1);
+}
+
+void BroadcastServer::encode(const Snapshot& snapshot) {
+    const int words = screenWords(snapshot.hires);
+    const size_t bytes = words * sizeof(uint64_t);
+    if (haveKey && snapshot.hires == keyHires && memcmp(snapshot.gfx, last, bytes) == 0) return;
+    memcpy(last, snapshot.gfx, bytes);
+
+    std::shared_ptr<Message> message = std::make_shared<Message>();
+    message->frame = snapshot.number;
+    BroadcastHeader header = {};
+    header.hires = snapshot.hires;
+    header.frame = snapshot.number;
+    std::vector<uint8_t>& out = message->bytes;
+    out.resize(sizeof(header));
+
+    if (!haveKey || snapshot.hires != keyHires || ++sinceKey >= interval) {
+        memcpy(key, snapshot.gfx, bytes);
+        keyHires = snapshot.hires;
+        haveKey = true;
+        sinceKey = 0;
+        header.type = BROADCAST_KEYFRAME;
+        out.insert(out.end(), (const uint8_t*)key, (const uint8_t*)key + bytes);
+        message->key = true;
+        message->keyId = ++keyId;
+    } else {
+        header.type = BROADCAST_DELTA;
+        const int rowWords = words / screenHeight(snapshot.hires);
+        uint64_t rows = 0;
+        std::vector<uint8_t> xored;
+        for (int row = 0; row < screenHeight(snapshot.hires); ++row) {
+            bool changed = false;
+            for (int w = 0; w < rowWords; ++w) changed |= snapshot.gfx[row * rowWords + w] != key[row * rowWords + w];
+            if (!changed) continue;
+            rows |= 1ULL << row;
+            for (int w = 0; w < rowWords; ++w) {
+                uint64_t x = snapshot.gfx[row * rowWords + w] ^ key[row * rowWords + w];
+                xored.insert(xored.end(), (const uint8_t*)&x, (const uint8_t*)&x + sizeof(x));
+            }
+        }
+        out.insert(out.end(), (const uint8_t*)&rows, (const uint8_t*)&rows + sizeof(rows));
+        // Runs of unchanged bytes, then changed ones; trailing unchanged bytes need no run
+        size_t i = 0;
+        while (i < xored.size()) {
+            size_t skip = 0;
+            while (i < xored.size() && xored[i] == 0 && skip < 0xFF) { i++; skip++; }
+            size_t start = i, count = 0;
+            while (i < xored.size() && xored[i] != 0 && count < 0xFF) { i++; count++; }
+            if (count == 0 && i == xored.size()) break;
+            out.push_back((uint8_t)skip);
+            out.push_back((uint8_t)count);
+            out.insert(out.end(), xored.begin() + start, xored.begin() + start + count);
+        }
+        message->key = false;
+        message->keyId = keyId;
+    }
+    header.size = (uint32_t)(out.size() - sizeof(header));
+    memcpy(out.data(), &header, sizeof(header));
+
+    latest = message;
+    if (message->key) keyMessage = message;
+}
+
+bool BroadcastServer::pump(Client& client) {
+    for (;;) {
+        if (!client.sending) {
+            // Whatever is newest; a client without the current keyframe gets that first
+            if (!keyMessage) return true;
+            if (client.keyId != keyMessage->keyId) client.sending = keyMessage;
+            else if (latest->frame > client.frame) client.sending = latest;
+            else return true;
+            client.offset = 0;
+        }
+        const std::vector<uint8_t>& bytes = client.sending->bytes;
+        ssize_t sent = send(client.fd, bytes.data() + client.offset, bytes.size() - client.offset, MSG_NOSIGNAL);
+        if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        client.offset += sent;
+        if (client.offset < bytes.size()) return true;
+        if (client.sending->key) client.keyId = client.sending->keyId;
+        client.frame = client.sending->frame;
+        client.sending.reset();
+    }
+}
+
+void BroadcastServer::serverLoop() {
+    std::vector<pollfd> fds;
+    while (running.load(std::memory_order_relaxed)) {
+        fds.clear();
+        fds.push_back({ listenFd, POLLIN, 0 });
+        fds.push_back({ wakeFds[0], POLLIN, 0 });
+        for (const Client& client : clientList) {
+            // Only wait to write to clients that are part way through a message
+            fds.push_back({ client.fd, (short)(client.sending ? POLLOUT : 0), 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) break;
+
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(wakeFds[0], drain, sizeof(drain)) > 0) {}
+            if (snapshots.update()) encode(snapshots.front());
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &STREAM_BUFFER, sizeof(STREAM_BUFFER));
+                Client client;
+                client.fd = fd;
+                clientList.push_back(client);
+            }
+        }
+
+        // Top up every client; the ones that closed or failed go
+        for (size_t i = 0; i < clientList.size();) {
+            bool hungUp = i + 2 < fds.size() && (fds[i + 2].revents & (POLLERR | POLLHUP));
+            if (hungUp || !pump(clientList[i])) {
+                close(clientList[i].fd);
+                clientList.erase(clientList.begin() + i);
+                fds.erase(fds.begin() + 2 + i);
+            } else {
+                ++i;
+            }
+        }
+        clientCount.store(clientList.size(), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+#include "triple_buffer.h"
+
+// Frame broadcasting to spectators.
+//
+// BroadcastServer listens on a local socket and streams the display to any
+// number of clients (chip8_spectate is a terminal one). The emulation thread
+// only hands each published frame over through a triple buffer; the
+// server's own thread encodes it once and every client sends from the same
+// shared buffer. Frames are a keyframe every so often, and in between the
+// rows that differ from that keyframe, XORed and run-length encoded, so any
+// delta can be decoded with just its keyframe. A client that can't keep up
+// is never waited for: when it's ready for more it gets the newest frame,
+// and whatever came out while it was busy is skipped.
+//
+// On the wire a message is a BroadcastHeader followed by `size` bytes:
+//   keyframe: the display's screenWords(hires) words
+//   delta:    a uint64 with a bit per row that differs from the keyframe,
+//             then the XOR of those rows' bytes as runs of
+//             uint8 zero bytes skipped, uint8 count, `count` bytes
+// All little-endian, rows packed as in Chip8::gfx.
+
+enum BroadcastType : uint8_t { BROADCAST_KEYFRAME = 0, BROADCAST_DELTA = 1 };
+
+struct BroadcastHeader {
+    uint8_t type;
+    uint8_t hires;
+    uint16_t reserved;
+    uint32_t size;           // payload bytes
+    uint64_t frame;          // frame number from the emulator
+};
+
+// "unix:PATH" for a Unix socket, otherwise "[HOST:]PORT" over TCP, HOST
+// defaulting to 127.0.0.1. Returns a socket fd, or -1 after printing why.
+int openBroadcastSocket(const std::string& address, bool listen);
+
+// Client side: the display as received so far
+struct BroadcastView {
+    uint64_t key[MAX_DISPLAY_WORDS];   // the last keyframe
+    uint64_t gfx[MAX_DISPLAY_WORDS];   // the last frame
+    bool hires = false;
+    bool haveKey = false;
+    uint64_t frame = 0;
+};
+
+// Apply one message. False if it doesn't decode (a delta before any
+// keyframe, or a bad payload).
+bool decodeBroadcast(BroadcastView& view, const BroadcastHeader& header, const uint8_t* payload);
+
+class BroadcastServer {
+public:
+    // A keyframe at least every `keyframeInterval` frames (and on mode switches)
+    explicit BroadcastServer(uint32_t keyframeInterval = 60);
+    ~BroadcastServer();
+
+    BroadcastServer(const BroadcastServer&) = delete;
+    BroadcastServer& operator=(const BroadcastServer&) = delete;
+
+    bool start(const std::string& address);
+    void stop();
+
+    // Producer (the emulation thread): a finished frame. Never waits.
+    void publish(const uint64_t* gfx, bool hires, uint64_t number);
+
+    size_t clients() const { return clientCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Snapshot {
+        uint64_t gfx[MAX_DISPLAY_WORDS];
+        bool hires;
+        uint64_t number;
+    };
+    struct Message {
+        std::vector<uint8_t> bytes;   // header and payload
+        uint64_t keyId;               // the keyframe it needs (or is)
+        uint64_t frame;
+        bool key;
+    };
+    struct Client {
+        int fd;
+        std::shared_ptr<const Message> sending;
+        size_t offset = 0;
+        uint64_t keyId = 0;           // keyframe it has, 0 for none yet
+        uint64_t frame = 0;           // newest frame it was sent
+    };
+
+    void serverLoop();
+    void encode(const Snapshot& snapshot);
+    bool pump(Client& client);        // send what it can; false once the client is gone
+
+    TripleBuffer<Snapshot> snapshots;
+    int listenFd = -1;
+    std::string socketPath;           // a Unix socket's, removed again on stop
+    int wakeFds[2] = { -1, -1 };      // publish -> server thread
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<size_t> clientCount{0};
+
+    // Server thread only
+    uint32_t interval;
+    std::vector<Client> clientList;
+    uint64_t key[MAX_DISPLAY_WORDS];
+    uint64_t last[MAX_DISPLAY_WORDS];
+    bool keyHires = false;
+    bool haveKey = false;
+    uint64_t keyId = 0;
+    uint64_t sinceKey = 0;
+    std::shared_ptr<const Message> keyMessage;
+    std::shared_ptr<const Message> latest;
+};
+
+#endif // BROADCAST_H
@@ -0,0 +1,203 @@
+#include "capture.h"
+
+#include <chrono>
+#include <cstring>
+
+// The kernel is compiled for AVX2 whatever the build flags and only used
+// when the CPU has it
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CHIP8_CAPTURE_AVX2 1
+#include <immintrin.h>
+#endif
+
+CaptureFormat captureFormatFor(const char* path) {
+    size_t length = strlen(path);
+    if (length >= 4 && strcmp(path + length - 4, ".y4m") == 0) return CaptureFormat::Y4m;
+    if (length >= 4 && strcmp(path + length - 4, ".rgb") == 0) return CaptureFormat::Rgb;
+    return CaptureFormat::Gray;
+}
+
+namespace {
+
+// Each bit twice: a low-res row half becomes a full hi-res row word
+uint64_t doubleBits(uint32_t bits) {
+    uint64_t v = bits;
+    v = (v | v << 16) & 0x0000FFFF0000FFFFULL;
+    v = (v | v << 8) & 0x00FF00FF00FF00FFULL;
+    v = (v | v << 4) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | v << 2) & 0x3333333333333333ULL;
+    v = (v | v << 1) & 0x5555555555555555ULL;
+    return v | v << 1;
+}
+
+// 8 pixels of a byte as 8 bytes of 0x00/0xFF, first pixel (the top bit) first in memory
+struct ByteMasks {
+    uint64_t masks[256];
+    ByteMasks() {
+        for (int b = 0; b < 256; ++b) {
+            masks[b] = 0;
+            for (int i = 0; i < 8; ++i) {
+                if (b & (0x80 >> i)) masks[b] |= 0xFFULL << (8 * i);
+            }
+        }
+    }
+};
+const ByteMasks byteMasks;
+
+// One 128-pixel row, two words, to a byte per pixel: 0xFF lit, 0 dark
+void expandRowScalar(const uint64_t* words, uint8_t* out) {
+    for (int w = 0; w < 2; ++w) {
+        for (int b = 0; b < 8; ++b) {
+            uint64_t mask = byteMasks.masks[(words[w] >> (56 - 8 * b)) & 0xFF];
+            memcpy(out + w * 64 + b * 8, &mask, 8);
+        }
+    }
+}
+
+#if CHIP8_CAPTURE_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void expandRowAvx2(const uint64_t* words, uint8_t* out) {
+    // Byte lane i takes byte 3 - i / 8 of the 32 pixels, whose top bit is the first pixel
+    const __m256i spread = _mm256_setr_epi64x(0x0303030303030303, 0x0202020202020202,
+                                              0x0101010101010101, 0x0000000000000000);
+    const __m256i bits = _mm256_set1_epi64x((int64_t)0x0102040810204080ULL);
+    for (int half = 0; half < 4; ++half) {
+        uint32_t chunk = (uint32_t)(words[half >> 1] >> (half & 1 ? 0 : 32));
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)chunk), spread);
+        _mm256_storeu_si256((__m256i*)(out + 32 * half), _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits));
+    }
+}
+
+const bool hasAvx2 = __builtin_cpu_supports("avx2");
+
+#endif
+
+void expandRow(const uint64_t* words, uint8_t* out) {
+#if CHIP8_CAPTURE_AVX2
+    if (hasAvx2) {
+        expandRowAvx2(words, out);
+        return;
+    }
+#endif
+    expandRowScalar(words, out);
+}
+
+// A whole display to CAPTURE_WIDTH x CAPTURE_HEIGHT bytes
+void expandFrame(const uint64_t* gfx, bool hires, uint8_t* out) {
+    if (hires) {
+        for (int y = 0; y < CAPTURE_HEIGHT; ++y) {
+            expandRow(gfx + 2 * y, out + y * CAPTURE_WIDTH);
+        }
+        return;
+    }
+    for (int y = 0; y < CAPTURE_HEIGHT / 2; ++y) {
+        uint64_t row[2] = { doubleBits((uint32_t)(gfx[y] >> 32)), doubleBits((uint32_t)gfx[y]) };
+        uint8_t* line = out + 2 * y * CAPTURE_WIDTH;
+        expandRow(row, line);
+        memcpy(line + CAPTURE_WIDTH, line, CAPTURE_WIDTH);
+    }
+}
+
+} // namespace
+
+VideoCapture::VideoCapture(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+    pixels.resize(CAPTURE_WIDTH * CAPTURE_HEIGHT);
+}
+
+VideoCapture::~VideoCapture() {
+    close();
+}
+
+bool VideoCapture::open(const char* path, CaptureFormat captureFormat, bool waitForRoom) {
+    close();
+    file = fopen(path, "wb");
+    if (!file) return false;
+    format = captureFormat;
+    lossless = waitForRoom;
+    haveLast = false;
+    failed = false;
+    framesWritten = 0;
+    framesRepeated = 0;
+    framesDropped = 0;
+    if (format == CaptureFormat::Y4m) {
+        failed = fprintf(file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", CAPTURE_WIDTH, CAPTURE_HEIGHT) < 0;
+    }
+    running = true;
+    writer = std::thread(&VideoCapture::writerLoop, this);
+    return true;
+}
+
+void VideoCapture::push(const uint64_t* gfx, bool hires) {
+    if (!file) return;
+    size_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == slots.size()) {
+        if (!lossless) {
+            // Not noting it as the last frame either, so the next one that
+            // matches it isn't taken for a repeat
+            framesDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
+    Slot& slot = slots[h & mask];
+    size_t bytes = screenWords(hires) * sizeof(uint64_t);
+    slot.repeat = haveLast && hires == lastHires && memcmp(gfx, last, bytes) == 0;
+    if (!slot.repeat) {
+        memcpy(slot.gfx, gfx, bytes);
+        slot.hires = hires;
+        memcpy(last, gfx, bytes);
+        lastHires = hires;
+        haveLast = true;
+    }
+    head.store(h + 1, std::memory_order_release);
+}
+
+bool VideoCapture::writeFrame(const Slot& slot) {
+    if (!slot.repeat) expandFrame(slot.gfx, slot.hires, pixels.data());
+    if (format == CaptureFormat::Y4m && fputs("FRAME\n", file) < 0) return false;
+    if (format != CaptureFormat::Rgb) return fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+
+    if (!slot.repeat) {
+        rgb.resize(pixels.size() * 3);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = pixels[i];
+        }
+    }
+    return fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+}
+
+void VideoCapture::writerLoop() {
+    for (;;) {
+        // Read running first: once it's clear, whatever is queued is all there will be
+        bool more = running.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (!more) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        const Slot& slot = slots[t & mask];
+        if (!failed && !writeFrame(slot)) failed = true;
+        if (slot.repeat) framesRepeated.fetch_add(1, std::memory_order_relaxed);
+        framesWritten.fetch_add(1, std::memory_order_relaxed);
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+bool VideoCapture::close() {
+    if (!file) return true;
+    running = false;
+    if (writer.joinable()) writer.join();
+    bool ok = !failed;
+    if (fclose(file) != 0) ok = false;
+    file = nullptr;
+    head = 0;
+    tail = 0;
+    return ok;
+}
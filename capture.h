@@ -0,0 +1,88 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+
+// Video capture of the display.
+//
+// The emulation thread pushes each finished frame's packed display into a
+// lock-free SPSC ring of frames, and a writer thread of its own expands the
+// 1-bit pixels to bytes (with an AVX2 kernel where the CPU has one) and
+// streams them to disk. Frames are always 128x64: low-res frames have their
+// pixels doubled, so a ROM switching modes doesn't change the video size.
+// A frame identical to the one before is queued as a repeat and written
+// from the writer's last expanded frame. If the writer falls behind, frames
+// that don't fit are dropped and counted rather than making the emulator
+// wait, unless the capture is lossless (for headless runs, which have no
+// clock to keep up with).
+
+// Y4M (luma only, `Cmono`), or headerless 8-bit gray or 24-bit RGB frames
+enum class CaptureFormat : uint8_t { Y4m, Gray, Rgb };
+
+const int CAPTURE_WIDTH = 128;
+const int CAPTURE_HEIGHT = 64;
+
+// By extension: .y4m, .rgb, anything else gray
+CaptureFormat captureFormatFor(const char* path);
+
+class VideoCapture {
+public:
+    explicit VideoCapture(size_t capacity = 64);
+    ~VideoCapture();
+
+    VideoCapture(const VideoCapture&) = delete;
+    VideoCapture& operator=(const VideoCapture&) = delete;
+
+    // Starts the writer thread; `lossless` makes push wait for room instead of dropping
+    bool open(const char* path, CaptureFormat format, bool lossless = false);
+    // Producer: queue a frame (see Screen for the layout)
+    void push(const uint64_t* gfx, bool hires);
+    // Writes out what's queued and closes the file; false if any write failed
+    bool close();
+
+    uint64_t written() const { return framesWritten.load(std::memory_order_relaxed); }
+    uint64_t repeated() const { return framesRepeated.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return framesDropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        uint64_t gfx[MAX_DISPLAY_WORDS];
+        bool hires;
+        bool repeat;             // same as the frame before, gfx not filled in
+    };
+
+    void writerLoop();
+    bool writeFrame(const Slot& slot);
+
+    std::vector<Slot> slots;
+    size_t mask;
+    std::atomic<size_t> head{0};   // written by the producer
+    std::atomic<size_t> tail{0};   // written by the writer
+
+    // Producer side: the last frame queued, to spot repeats
+    uint64_t last[MAX_DISPLAY_WORDS];
+    bool lastHires = false;
+    bool haveLast = false;
+    bool lossless = false;
+
+    // Writer side
+    FILE* file = nullptr;
+    CaptureFormat format = CaptureFormat::Y4m;
+    std::vector<uint8_t> pixels;   // the last frame, expanded
+    std::vector<uint8_t> rgb;
+    bool failed = false;
+
+    std::thread writer;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<uint64_t> framesRepeated{0};
+    std::atomic<uint64_t> framesDropped{0};
+};
+
+#endif // CAPTURE_H
@@ -0,0 +1,954 @@
+#include "chip8.h"
+#include "aot.h"
+#include "jit.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+// Standard 4x5 hex font, loaded at address 0 (see Fx29)
+static const uint8_t fontset[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// SUPER-CHIP 8x10 hex font (A-F from XO-CHIP), see Fx30
+static const uint8_t bigFontset[160] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+void resetChip8(Chip8& chip) {
+    // Zero everything so two runs of the same ROM start from the same state
+    memset(&chip, 0, sizeof(chip));
+    memcpy(chip.memory, fontset, sizeof(fontset));
+    memcpy(chip.memory + BIG_FONT_ADDRESS, bigFontset, sizeof(bigFontset));
+    invalidateDecodeCache(chip);
+    seedRandom(chip, 0);
+    chip.idleSkip = true;
+    chip.dirtyRows = allRows(false); // whatever was on screen before is stale
+    chip.pc = 0x200; // Start of most CHIP-8 programs
+}
+
+bool loadROMData(Chip8& chip, const uint8_t* data, size_t size) {
+    // Programs live between 0x200 and the end of memory
+    if (size > MAX_ROM_SIZE) {
+        std::cout << "ROM too large: " << size << " bytes, at most " << MAX_ROM_SIZE << " fit" << std::endl;
+        return false;
+    }
+    memcpy(chip.memory + 0x200, data, size);
+    invalidateDecodeCache(chip);
+    return true;
+}
+
+bool loadROM(const char* filename, Chip8& chip) {
+    // Open the file in binary mode and move the file pointer to the end
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        // If the file couldn't be opened, return false
+        std::cout << "Failed to open ROM: " << filename << std::endl;
+        return false;
+    }
+
+    // Get the size of the file
+    std::streamsize size = file.tellg();
+    // Move the file pointer back to the beginning
+    file.seekg(0, std::ios::beg);
+
+    // Create a buffer to hold the file contents
+    std::vector<char> buffer(size);
+    // Read the file into the buffer, then copy it into memory at 0x200
+    if (file.read(buffer.data(), size) && loadROMData(chip, (const uint8_t*)buffer.data(), (size_t)size)) {
+        // Return true if the file was successfully read
+        std::cout << "Successfully loaded ROM: " << filename << std::endl;
+        return true;
+    }
+
+    // Return false if there was an error reading the file
+    return false;
+}
+
+void printGFX(const Chip8& chip) {
+    std::cout << "\n===== DISPLAY BUFFER =====\n";
+    for (int y = 0; y < screenHeight(chip.hires); ++y) {
+        for (int x = 0; x < screenWidth(chip.hires); ++x) {
+            std::cout << (getPixel(chip, x, y) ? "█" : " ");
+        }
+        std::cout << "\n";
+    }
+    std::cout << "==========================\n";
+}
+
+void printRom(const Chip8& chip) {
+    for (int i = 0; i < 1000; ++i) {
+        uint16_t addr = 0x200 + (i * 2);
+        uint16_t op = (chip.memory[addr] << 8) | chip.memory[addr + 1];
+        std::cout << "0x" << std::hex << addr << ": " << std::hex << op << std::endl;
+    }
+}
+
+static uint16_t opDecode(Chip8& chip, const DecodedOp& op, uint16_t pc);
+
+void writeMemory(Chip8& chip, uint16_t addr, uint8_t value) {
+    addr &= 0xFFF;
+    chip.memory[addr] = value;
+    // The byte is the high half of the opcode at addr and the low half of the one at addr - 1
+    chip.decoded[addr].handler = opDecode;
+    chip.decoded[(addr - 1) & 0xFFF].handler = opDecode;
+    if (chip.jit) jitInvalidate(*chip.jit, addr);
+    if (chip.aot) aotInvalidate(*chip.aot, addr);
+}
+
+void invalidateDecodeCache(Chip8& chip) {
+    for (auto& op : chip.decoded) {
+        op.handler = opDecode;
+    }
+    if (chip.jit) jitFlush(*chip.jit);
+    if (chip.aot) aotFlush(*chip.aot, chip);
+}
+
+template <bool Wrap>
+bool drawSprite(const Screen& screen, const uint8_t* memory, uint16_t I, uint8_t vx, uint8_t vy, uint8_t n) {
+    const int height = screenHeight(screen.hires);
+    const int x = vx & (screenWidth(screen.hires) - 1);
+    const int y = vy & (height - 1);
+    const bool wide = n == 0;
+    const int rows = wide ? 16 : n;
+    uint64_t collision = 0;
+    uint64_t dirty = 0;
+
+    for (int yline = 0; yline < rows && (Wrap || y + yline < height); yline++) {
+        const int row = Wrap ? (y + yline) & (height - 1) : y + yline;
+        // The sprite row left-aligned in a word...
+        uint64_t bits;
+        if (wide) bits = (uint64_t)(memory[(I + 2 * yline) & 0xFFF] << 8 | memory[(I + 2 * yline + 1) & 0xFFF]) << 48;
+        else bits = (uint64_t)memory[(I + yline) & 0xFFF] << 56;
+
+        if (!screen.hires) {
+            // ...lined up with its screen column; bits past x = 63 fall off
+            // (or come back in at x = 0)
+            uint64_t& word = screen.gfx[row];
+            uint64_t shifted = bits >> x;
+            if (Wrap && x) shifted |= bits << (64 - x);
+            collision |= word & shifted;
+            word ^= shifted;
+            if (shifted) dirty |= 1ULL << row;
+        } else {
+            // ...split across the row's two words; bits past x = 127 fall off
+            // (or come back in at x = 0)
+            uint64_t* words = screen.gfx + 2 * row;
+            uint64_t left = x < 64 ? bits >> x : 0;
+            uint64_t right = x == 0 ? 0 : x < 64 ? bits << (64 - x) : bits >> (x - 64);
+            if (Wrap && x > 64) left = bits << (128 - x);
+            collision |= (words[0] & left) | (words[1] & right);
+            words[0] ^= left;
+            words[1] ^= right;
+            if (left | right) dirty |= 1ULL << row;
+        }
+    }
+    *screen.dirtyRows |= dirty;
+    return collision != 0;
+}
+
+template bool drawSprite<false>(const Screen&, const uint8_t*, uint16_t, uint8_t, uint8_t, uint8_t);
+template bool drawSprite<true>(const Screen&, const uint8_t*, uint16_t, uint8_t, uint8_t, uint8_t);
+
+// Vertical scrolls move whole rows, which are whole words
+void scrollDown(const Screen& screen, int n) {
+    const int stride = screen.hires ? 2 : 1;
+    const int words = screenWords(screen.hires);
+    const int shift = std::min(n, screenHeight(screen.hires)) * stride;
+    if (shift == 0) return;
+    memmove(screen.gfx + shift, screen.gfx, (words - shift) * sizeof(uint64_t));
+    memset(screen.gfx, 0, shift * sizeof(uint64_t));
+    *screen.dirtyRows |= allRows(screen.hires);
+}
+
+void scrollUp(const Screen& screen, int n) {
+    const int stride = screen.hires ? 2 : 1;
+    const int words = screenWords(screen.hires);
+    const int shift = std::min(n, screenHeight(screen.hires)) * stride;
+    if (shift == 0) return;
+    memmove(screen.gfx, screen.gfx + shift, (words - shift) * sizeof(uint64_t));
+    memset(screen.gfx + words - shift, 0, shift * sizeof(uint64_t));
+    *screen.dirtyRows |= allRows(screen.hires);
+}
+
+// Horizontal ones shift each row, carrying across a hi-res row's two words
+void scrollRight(const Screen& screen, int n) {
+    if (n <= 0) return;
+    if (n >= 64) n = 63;
+    const int height = screenHeight(screen.hires);
+    if (!screen.hires) {
+        for (int y = 0; y < height; ++y) screen.gfx[y] >>= n;
+    } else {
+        for (uint64_t* row = screen.gfx; row < screen.gfx + 2 * height; row += 2) {
+            row[1] = row[1] >> n | row[0] << (64 - n);
+            row[0] >>= n;
+        }
+    }
+    *screen.dirtyRows |= allRows(screen.hires);
+}
+
+void scrollLeft(const Screen& screen, int n) {
+    if (n <= 0) return;
+    if (n >= 64) n = 63;
+    const int height = screenHeight(screen.hires);
+    if (!screen.hires) {
+        for (int y = 0; y < height; ++y) screen.gfx[y] <<= n;
+    } else {
+        for (uint64_t* row = screen.gfx; row < screen.gfx + 2 * height; row += 2) {
+            row[0] = row[0] << n | row[1] >> (64 - n);
+            row[1] <<= n;
+        }
+    }
+    *screen.dirtyRows |= allRows(screen.hires);
+}
+
+void setHires(Chip8& chip, bool hires) {
+    chip.hires = hires;
+    memset(chip.gfx, 0, sizeof(chip.gfx));
+    chip.dirtyRows = allRows(hires);
+}
+
+// 00E0 - Clear screen
+static uint16_t opCLS(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    memset(chip.gfx, 0, screenWords(chip.hires) * sizeof(uint64_t));
+    chip.dirtyRows = allRows(chip.hires);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00CN - Scroll the display down N pixels (SUPER-CHIP)
+static uint16_t opSCD(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    scrollDown(screenOf(chip), op.n);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00DN - Scroll the display up N pixels (XO-CHIP)
+static uint16_t opSCU(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    scrollUp(screenOf(chip), op.n);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00FB - Scroll the display right 4 pixels (SUPER-CHIP)
+static uint16_t opSCR(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    scrollRight(screenOf(chip), 4);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00FC - Scroll the display left 4 pixels (SUPER-CHIP)
+static uint16_t opSCL(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    scrollLeft(screenOf(chip), 4);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00FD - Exit the interpreter (SUPER-CHIP): stays on this instruction from then on
+static uint16_t opEXIT(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    return pc;
+}
+
+// 00FE / 00FF - Switch to 64x32 / 128x64 (SUPER-CHIP), clearing the screen as XO-CHIP does
+static uint16_t opLOW(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    setHires(chip, false);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+static uint16_t opHIGH(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    setHires(chip, true);
+    chip.drawFlag = true;
+    pc += 2;
+    return pc;
+}
+
+// 00EE - Return from subroutine
+static uint16_t opRET(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.sp--;
+    pc = chip.stack[chip.sp & 0xF];
+    pc += 2;
+    return pc;
+}
+
+// 1NNN - Jump to address NNN
+static uint16_t opJP(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc = op.nnn;
+    return pc;
+}
+
+// 2NNN - Call subroutine at NNN
+static uint16_t opCALL(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.stack[chip.sp & 0xF] = pc; // Store current PC in the stack
+    chip.sp++;
+    pc = op.nnn;
+    return pc;
+}
+
+// 3XNN - Skip next instruction if Vx == NN
+static uint16_t opSEi(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += chip.V[op.x] == op.nn ? 4 : 2;
+    return pc;
+}
+
+// 4XNN - Skip next instruction if Vx != NN
+static uint16_t opSNEi(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += chip.V[op.x] != op.nn ? 4 : 2;
+    return pc;
+}
+
+// 5XY0 - Skip next instruction if Vx == Vy
+static uint16_t opSE(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += chip.V[op.x] == chip.V[op.y] ? 4 : 2;
+    return pc;
+}
+
+// 6XNN - Set Vx = NN
+static uint16_t opLDi(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] = op.nn;
+    pc += 2;
+    return pc;
+}
+
+// 7XNN - Add NN to Vx
+static uint16_t opADDi(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] += op.nn;
+    pc += 2;
+    return pc;
+}
+
+// 8XY0 - Copy the value in register VY into VX
+static uint16_t opLD(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] = chip.V[op.y];
+    pc += 2;
+    return pc;
+}
+
+// 8XY1 - Sets VX to (VX OR VY), and VF to 0 on the VIP
+template <typename Q>
+static uint16_t opOR(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] |= chip.V[op.y];
+    if (Q::vfReset) chip.V[0xF] = 0;
+    pc += 2;
+    return pc;
+}
+
+// 8XY2 - Set VX equal to the bitwise and of the values in VX and VY (VF = 0 on the VIP)
+template <typename Q>
+static uint16_t opAND(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] &= chip.V[op.y];
+    if (Q::vfReset) chip.V[0xF] = 0;
+    pc += 2;
+    return pc;
+}
+
+// 8XY3 - Set VX equal to the bitwise xor of the values in VX and VY (VF = 0 on the VIP)
+template <typename Q>
+static uint16_t opXOR(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] ^= chip.V[op.y];
+    if (Q::vfReset) chip.V[0xF] = 0;
+    pc += 2;
+    return pc;
+}
+
+// 8XY4 - Set VX equal to VX plus VY. In the case of an overflow(carry) VF is set to 1. Otherwise 0.
+static uint16_t opADD(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] = (chip.V[op.x] + chip.V[op.y]) & 0xFF;
+    chip.V[0xF] = chip.V[op.y] > chip.V[op.x] ? 1 : 0;
+    pc += 2;
+    return pc;
+}
+
+// 8XY5 - Set VX equal to VX minus VY. In the case of an underflow VF is set 0. Otherwise 1. (VF = VX > VY)
+static uint16_t opSUB(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[0xF] = chip.V[op.x] >= chip.V[op.y] ? 1 : 0;
+    chip.V[op.x] = (chip.V[op.x] - chip.V[op.y]) & 0xFF;
+    pc += 2;
+    return pc;
+}
+
+// 8XY6 - Set VX equal to VX bitshifted right 1. VF is set to the least significant bit of VX prior to the shift.
+// The VIP and XO-CHIP shift VY instead.
+template <typename Q>
+static uint16_t opSHR(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    const uint8_t from = Q::shiftVy ? op.y : op.x;
+    chip.V[0xF] = chip.V[from] & 0x1;
+    chip.V[op.x] = chip.V[from] >> 1;
+    pc += 2;
+    return pc;
+}
+
+// 8XY7 - Set VX equal to VY minus VX. VF is set to 1 if VY > VX. Otherwise 0.
+static uint16_t opSUBN(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[0xF] = chip.V[op.y] > chip.V[op.x] ? 1 : 0;
+    chip.V[op.x] = (chip.V[op.y] - chip.V[op.x]) & 0xFF;
+    pc += 2;
+    return pc;
+}
+
+// 8XYE - Set VX equal to VX bitshifted left 1. VF is set to the most significant bit of VX prior to the shift
+// (VY on the VIP and XO-CHIP, like 8XY6)
+template <typename Q>
+static uint16_t opSHL(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    const uint8_t from = Q::shiftVy ? op.y : op.x;
+    chip.V[0xF] = (chip.V[from] & 0x80) ? 1 : 0;
+    chip.V[op.x] = (chip.V[from] << 1) & 0xFF;
+    pc += 2;
+    return pc;
+}
+
+// 9XY0 - Skip next instruction if Vx != Vy
+static uint16_t opSNE(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += chip.V[op.x] != chip.V[op.y] ? 4 : 2;
+    return pc;
+}
+
+// ANNN - Set I equal to NNN
+static uint16_t opLDI(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.I = op.nnn;
+    pc += 2;
+    return pc;
+}
+
+// BNNN - Set the PC to NNN plus the value in V0 (XNN plus VX on SUPER-CHIP)
+template <typename Q>
+static uint16_t opJPV0(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc = op.nnn + chip.V[Q::jumpVx ? op.x : 0];
+    return pc;
+}
+
+// CXNN - Set VX equal to a random number ranging from 0 to 255 which is logically anded with NN
+static uint16_t opRND(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    // xorshift32
+    chip.rng ^= chip.rng << 13;
+    chip.rng ^= chip.rng >> 17;
+    chip.rng ^= chip.rng << 5;
+    uint8_t rnd = chip.rng >> 24;
+    chip.V[op.x] = rnd & op.nn;
+    pc += 2;
+    return pc;
+}
+
+// DXYN - Draw sprite at (Vx, Vy) with width 8 pixels and height N pixels,
+// or a 16x16 one for DXY0. The start position wraps around the screen, the
+// sprite itself is clipped at the edges (or wraps, on XO-CHIP).
+template <typename Q>
+static uint16_t opDRW(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    // On the VIP, drawing holds the CPU until the next 60Hz tick: this stays
+    // on the instruction after drawing, and moves on once tickTimers has run
+    if (Q::displayWait && chip.drawWait) {
+        if (!chip.vblank) return pc;
+        chip.drawWait = false;
+        pc += 2;
+        return pc;
+    }
+    bool collision = drawSprite<Q::wrap>(screenOf(chip), chip.memory, chip.I, chip.V[op.x], chip.V[op.y], op.n);
+    chip.V[0xF] = collision ? 1 : 0;
+    chip.drawFlag = true;
+    if (Q::displayWait) {
+        chip.drawWait = true;
+        chip.vblank = false;
+        return pc;
+    }
+    pc += 2;
+    return pc;
+}
+
+static uint16_t opSKP(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += (chip.V[op.x] < 16 && chip.keypad[chip.V[op.x]] == 1) ? 4 : 2;
+    return pc;
+}
+
+// EXA1 - Skip next instruction if key with value of Vx is not pressed
+static uint16_t opSKNP(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += (chip.V[op.x] < 16 && chip.keypad[chip.V[op.x]] == 1) ? 2 : 4;
+    return pc;
+}
+
+// FX0A - Wait for a key press and release, and put the key in VX. Keys
+// already down when the wait starts only count once they've been let go and
+// pressed again. Until then pc stays here and the instruction runs again.
+static uint16_t opKEY(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    uint16_t down = 0;
+    for (int key = 0; key < 16; ++key) {
+        if (chip.keypad[key]) down |= 1 << key;
+    }
+    if (!chip.keyWait) {
+        chip.keyWait = true;
+        chip.keyWaitHeld = down;
+        chip.keyWaitPressed = 0;
+    }
+    chip.keyWaitHeld &= down;
+    chip.keyWaitPressed |= down & ~chip.keyWaitHeld;
+    const uint16_t released = chip.keyWaitPressed & ~down;
+    if (!released) return pc;
+    chip.V[op.x] = (uint8_t)__builtin_ctz(released);
+    chip.keyWait = false;
+    pc += 2;
+    return pc;
+}
+
+// FX07 - Set VX equal to the delay timer
+static uint16_t opLDVxDT(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.V[op.x] = chip.delay_timer;
+    pc += 2;
+    return pc;
+}
+
+// FX15 - Set delay timer = Vx
+static uint16_t opLDDTVx(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.delay_timer = chip.V[op.x];
+    pc += 2;
+    return pc;
+}
+
+// FX18 - Set sound timer = Vx
+static uint16_t opLDSTVx(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    // Logged for sample-accurate audio; nobody draining it just means the log stays full
+    logSoundWrite(chip, chip.instructionCount, chip.V[op.x]);
+    chip.sound_timer = chip.V[op.x];
+    pc += 2;
+    return pc;
+}
+
+// FX1E - Add VX to I. VF is set to 1 if I > 0x0FFF. Otherwise set to 0.
+static uint16_t opADDIVx(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    uint16_t sum = chip.I + chip.V[op.x];
+    chip.V[0xF] = (sum > 0x0FFF) ? 1 : 0;
+    chip.I = sum & 0x0FFF;
+    pc += 2;
+    return pc;
+}
+
+// FX29 - Set I to the address of the CHIP-8 8x5 font sprite representing the value in VX
+static uint16_t opLDF(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.I = chip.V[op.x] * 5; // font sprites start at address 0
+    pc += 2;
+    return pc;
+}
+
+// FX30 - Set I to the address of the SUPER-CHIP 8x10 font sprite for the low nibble of VX
+static uint16_t opLDHF(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    chip.I = BIG_FONT_ADDRESS + (chip.V[op.x] & 0xF) * 10;
+    pc += 2;
+    return pc;
+}
+
+// FX33 - Convert VX to BCD and store the 3 digits at memory location I through I+2. I does not change.
+static uint16_t opBCD(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    uint8_t value = chip.V[op.x];
+    writeMemory(chip, chip.I,     value / 100);
+    writeMemory(chip, chip.I + 1, (value / 10) % 10);
+    writeMemory(chip, chip.I + 2, value % 10);
+    pc += 2;
+    return pc;
+}
+
+// FX55 - Store registers V0 through Vx in memory starting at address I
+// (and leave I past them, on the VIP and XO-CHIP)
+template <typename Q>
+static uint16_t opSTORE(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    for (int i = 0; i <= op.x; ++i) {
+        writeMemory(chip, chip.I + i, chip.V[i]);
+    }
+    if (Q::memoryIncrement) chip.I = (chip.I + op.x + 1) & 0xFFF;
+    pc += 2;
+    return pc;
+}
+
+// FX65 - Copy values from memory location I through I + X into registers V0 through VX.
+// I does not change, except on the VIP and XO-CHIP, like FX55.
+template <typename Q>
+static uint16_t opLOAD(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    for (int i = 0; i <= op.x; i++) {
+        chip.V[i] = chip.memory[(chip.I + i) & 0xFFF];
+    }
+    if (Q::memoryIncrement) chip.I = (chip.I + op.x + 1) & 0xFFF;
+    pc += 2;
+    return pc;
+}
+
+// FX75 - Save V0 through VX in the user flags (SUPER-CHIP, up to VF as in XO-CHIP)
+static uint16_t opSTORER(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    memcpy(chip.rplFlags, chip.V, op.x + 1);
+    pc += 2;
+    return pc;
+}
+
+// FX85 - Load V0 through VX from the user flags
+static uint16_t opLOADR(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    memcpy(chip.V, chip.rplFlags, op.x + 1);
+    pc += 2;
+    return pc;
+}
+
+// FF80 - Custom opcode, treated as a NOP / marker (possibly sprite data)
+static uint16_t opFF80(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += 2;
+    return pc;
+}
+
+// Unknown opcode that is skipped over. Reported once, when it is decoded.
+static uint16_t opUnknownSkip(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    pc += 2;
+    return pc;
+}
+
+// Unknown opcode that leaves pc where it is. Reported once, when it is decoded.
+static uint16_t opUnknown(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    return pc;
+}
+
+template <typename Q>
+static DecodedOp decodeFor(uint16_t opcode) {
+    DecodedOp op;
+    op.opcode = opcode;
+    op.nnn = opcode & 0x0FFF;
+    op.x = (opcode & 0x0F00) >> 8;
+    op.y = (opcode & 0x00F0) >> 4;
+    op.n = opcode & 0x000F;
+    op.nn = opcode & 0x00FF;
+    op.handler = opUnknown;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (op.nn == 0xE0) op.handler = opCLS;
+            else if (op.nn == 0xEE) op.handler = opRET;
+            else if (op.x == 0 && op.y == 0xC) op.handler = opSCD;
+            else if (op.x == 0 && op.y == 0xD) op.handler = opSCU;
+            else if (op.nn == 0xFB) op.handler = opSCR;
+            else if (op.nn == 0xFC) op.handler = opSCL;
+            else if (op.nn == 0xFD) op.handler = opEXIT;
+            else if (op.nn == 0xFE) op.handler = opLOW;
+            else if (op.nn == 0xFF) op.handler = opHIGH;
+            break;
+        case 0x1000: op.handler = opJP; break;
+        case 0x2000: op.handler = opCALL; break;
+        case 0x3000: op.handler = opSEi; break;
+        case 0x4000: op.handler = opSNEi; break;
+        case 0x5000: op.handler = op.n == 0 ? opSE : opUnknownSkip; break;
+        case 0x6000: op.handler = opLDi; break;
+        case 0x7000: op.handler = opADDi; break;
+        case 0x8000:
+            switch (op.n) {
+                case 0x0: op.handler = opLD; break;
+                case 0x1: op.handler = opOR<Q>; break;
+                case 0x2: op.handler = opAND<Q>; break;
+                case 0x3: op.handler = opXOR<Q>; break;
+                case 0x4: op.handler = opADD; break;
+                case 0x5: op.handler = opSUB; break;
+                case 0x6: op.handler = opSHR<Q>; break;
+                case 0x7: op.handler = opSUBN; break;
+                case 0xE: op.handler = opSHL<Q>; break;
+                default: op.handler = opUnknownSkip; break;
+            }
+            break;
+        case 0x9000: op.handler = op.n == 0 ? opSNE : opUnknownSkip; break;
+        case 0xA000: op.handler = opLDI; break;
+        case 0xB000: op.handler = opJPV0<Q>; break;
+        case 0xC000: op.handler = opRND; break;
+        case 0xD000: op.handler = opDRW<Q>; break;
+        case 0xE000:
+            if (op.nn == 0xA1) op.handler = opSKNP;
+            else op.handler = opSKP;
+            break;
+        case 0xF000:
+            switch (op.nn) {
+                case 0x07: op.handler = opLDVxDT; break;
+                case 0x0A: op.handler = opKEY; break;
+                case 0x15: op.handler = opLDDTVx; break;
+                case 0x18: op.handler = opLDSTVx; break;
+                case 0x1E: op.handler = opADDIVx; break;
+                case 0x29: op.handler = opLDF; break;
+                case 0x30: op.handler = opLDHF; break;
+                case 0x33: op.handler = opBCD; break;
+                case 0x55: op.handler = opSTORE<Q>; break;
+                case 0x65: op.handler = opLOAD<Q>; break;
+                case 0x75: op.handler = opSTORER; break;
+                case 0x85: op.handler = opLOADR; break;
+                case 0x80: op.handler = opFF80; break;
+            }
+            break;
+    }
+    return op;
+}
+
+DecodedOp decodeOpcode(uint16_t opcode, QuirkProfile quirks) {
+    return withQuirks(quirks, [&](auto q) { return decodeFor<decltype(q)>(opcode); });
+}
+
+void setQuirkProfile(Chip8& chip, QuirkProfile quirks) {
+    chip.quirks = quirks;
+    invalidateDecodeCache(chip);
+}
+
+// Placeholder handler for addresses that haven't been decoded yet: decode,
+// cache the result and run it, so the dispatch loop never has to check
+static uint16_t opDecode(Chip8& chip, const DecodedOp& op, uint16_t pc) {
+    DecodedOp& entry = chip.decoded[pc & 0xFFF];
+    entry = decodeOpcode(chip.memory[pc & 0xFFF] << 8 | chip.memory[(pc + 1) & 0xFFF], chip.quirks);
+    if (entry.handler == opUnknown || entry.handler == opUnknownSkip) {
+        std::cerr << "Unknown opcode: " << std::hex << entry.opcode << " at 0x" << (pc & 0xFFF) << std::dec << std::endl;
+    }
+    return entry.handler(chip, entry, pc);
+}
+
+void emulateCycle(Chip8& chip) {
+    runCycles(chip, 1);
+}
+
+// Handlers that only write V, I and pc, and only read memory, timers and
+// keys (FX0A's wait state aside, which settles after one run). A loop made
+// of nothing else that ends an iteration with the same registers it started
+// with will go round identically until a timer or key changes. A VIP DXYN draws and then stays put until the next tick, so
+// once it has run the rest of the run is it spinning: as a loop on its own
+// it is idle too, and anywhere else it ends the loop's iterations.
+template <typename Q>
+static bool isIdleSafeFor(OpHandler handler) {
+    return handler == opJPV0<Q> || handler == opOR<Q> || handler == opAND<Q> || handler == opXOR<Q> ||
+           handler == opSHR<Q> || handler == opSHL<Q> || handler == opLOAD<Q> ||
+           (Q::displayWait && handler == opDRW<Q>);
+}
+
+static bool isIdleSafe(OpHandler handler) {
+    return handler == opJP || handler == opSEi || handler == opSNEi ||
+           handler == opSE || handler == opSNE || handler == opLDi || handler == opADDi ||
+           handler == opLD || handler == opADD || handler == opSUB || handler == opSUBN ||
+           handler == opLDI || handler == opADDIVx || handler == opLDF ||
+           handler == opLDVxDT || handler == opSKP || handler == opSKNP || handler == opKEY ||
+           handler == opLDHF || handler == opLOADR || handler == opEXIT ||
+           handler == opFF80 || handler == opUnknownSkip || handler == opUnknown ||
+           isIdleSafeFor<ModernQuirks>(handler) || isIdleSafeFor<VipQuirks>(handler) ||
+           isIdleSafeFor<SuperChipQuirks>(handler) || isIdleSafeFor<XoChipQuirks>(handler);
+}
+
+// Longest loop recognised, in instructions
+const uint64_t IDLE_MAX_LOOP = 64;
+// Shorter runs aren't worth checking: finding a loop costs an iteration of it
+const uint64_t IDLE_MIN_RUN = 32;
+
+uint64_t skipIdleLoop(Chip8& chip, uint64_t count) {
+    if (chip.keyWait && count > 0) {
+        // FX0A: one run sees the keypad as it is now, and if that didn't end
+        // the wait nothing will until the keys change, so park on it
+        NoTrace noTrace;
+        runCyclesTraced(chip, 1, noTrace);
+        if (!chip.keyWait) return 1;
+        chip.instructionCount += count - 1;
+        return count;
+    }
+    if (!chip.idleSkip || count < IDLE_MIN_RUN) return 0;
+    // Busy code: back off exponentially so failed checks cost next to nothing
+    if (chip.idleBackoff) {
+        chip.idleBackoff--;
+        return 0;
+    }
+
+    const uint16_t start = chip.pc;
+    const uint16_t startI = chip.I;
+    uint8_t startV[16];
+    memcpy(startV, chip.V, sizeof(startV));
+
+    uint16_t pc = start;
+    uint64_t executed = 0;
+    while (executed < IDLE_MAX_LOOP && executed < count) {
+        const DecodedOp& op = chip.decoded[pc & 0xFFF];
+        if (!isIdleSafe(op.handler)) break;
+        pc = op.handler(chip, op, pc);
+        executed++;
+
+        if (pc == start && chip.I == startI && memcmp(chip.V, startV, sizeof(startV)) == 0) {
+            // Every further iteration ends in this same state, so only the
+            // last partial iteration needs running
+            uint64_t remaining = count - executed;
+            uint64_t partial = remaining % executed;
+            chip.pc = pc;
+            chip.instructionCount += count - partial;
+            NoTrace noTrace;
+            runCyclesTraced(chip, partial, noTrace);
+            chip.idleFailures = 0;
+            return count;
+        }
+    }
+
+    chip.pc = pc;
+    chip.instructionCount += executed;
+    if (chip.idleFailures < 6) chip.idleFailures++;
+    chip.idleBackoff = (uint16_t)((1u << chip.idleFailures) - 1);
+    return executed;
+}
+
+// Instructions run between idle loop checks
+const uint64_t IDLE_CHECK_INTERVAL = 64;
+
+void runCycles(Chip8& chip, uint64_t count) {
+#ifdef CHIP8_TRACE
+    if (chip.trace) {
+        runCyclesTraced(chip, count, *chip.trace);
+        return;
+    }
+#endif
+    if (chip.profiler) {
+        runCyclesTraced(chip, count, *chip.profiler);
+        return;
+    }
+    NoTrace noTrace;
+    while (count > 0) {
+        count -= skipIdleLoop(chip, count);
+        uint64_t chunk = std::min(count, IDLE_CHECK_INTERVAL);
+        runCyclesTraced(chip, chunk, noTrace);
+        count -= chunk;
+    }
+}
+
+void seedRandom(Chip8& chip, uint32_t seed) {
+    // xorshift never leaves a zero state, so zero can't be a seed
+    chip.rng = seed ? seed : 0x2545F491;
+}
+
+void tickTimers(Chip8& chip) {
+    chip.vblank = true;
+    if (chip.delay_timer > 0) chip.delay_timer--;
+    if (chip.sound_timer > 0) chip.sound_timer--;
+    chip.frames++;
+}
+
+uint32_t instructionsForFrame(uint32_t ips, uint64_t frame) {
+    uint64_t index = frame % 60;
+    return (uint32_t)((index + 1) * ips / 60 - index * ips / 60);
+}
+
+void runInstructions(Chip8& chip, uint64_t count) {
+    if (chip.aot) {
+        aotRunCycles(chip, count);
+    } else if (chip.jit) {
+        jitRunCycles(chip, count);
+    } else {
+        runCycles(chip, count);
+    }
+}
+
+void runFrame(Chip8& chip, uint32_t instructions) {
+    runInstructions(chip, instructions);
+    tickTimers(chip);
+}
+
+uint32_t vipCycles(uint16_t opcode) {
+    const uint8_t x = (opcode >> 8) & 0xF;
+    const uint8_t n = opcode & 0xF;
+    const uint8_t nn = opcode & 0xFF;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0 || (opcode & 0xFFE0) == 0x00C0 || opcode == 0x00FB || opcode == 0x00FC) return 24;
+            return 23;
+        case 0x1000: case 0x2000: case 0xB000: return 23;
+        case 0x3000: case 0x4000: case 0xA000: return 12;
+        case 0x5000: case 0x9000: return 16;
+        case 0x6000: return 6;
+        case 0x7000: return 10;
+        case 0x8000: return 44;
+        case 0xC000: return 36;
+        // Each row is fetched, shifted into place and XORed in with a collision check
+        case 0xD000: return 68 + (n ? n : 32) * 46;
+        case 0xE000: return 16;
+        case 0xF000:
+            switch (nn) {
+                case 0x1E: return 19;
+                case 0x29: case 0x30: return 20;
+                case 0x33: return 204;
+                case 0x55: case 0x65: case 0x75: case 0x85: return 14 + 14 * (x + 1);
+                default: return 10;
+            }
+    }
+    return 10;
+}
+
+bool runCyclesTimed(Chip8& chip, uint64_t count) {
+    if (chip.cycles >= chip.cycleDeadline) chip.cycleDeadline += VIP_FRAME_CYCLES;
+    for (uint64_t i = 0; i < count && chip.cycles < chip.cycleDeadline; ++i) {
+        const uint16_t pc = chip.pc & 0xFFF;
+        // Coming out of a display wait is the end of the DXYN that started it, not another one
+        const bool resuming = chip.drawWait;
+        chip.cycles += resuming ? 0 : vipCycles(chip.memory[pc] << 8 | chip.memory[(pc + 1) & 0xFFF]);
+        runCycles(chip, 1);
+        if (chip.drawWait) {
+            chip.cycles = std::max(chip.cycles, chip.cycleDeadline);
+        }
+    }
+    return chip.cycles >= chip.cycleDeadline;
+}
+
+void runFrameTimed(Chip8& chip) {
+    runCyclesTimed(chip, UINT64_MAX);
+    tickTimers(chip);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t hashData(const void* data, size_t size) {
+    return fnv1a(0xcbf29ce484222325ULL, data, size);
+}
+
+uint64_t hashFramebuffer(const Chip8& chip) {
+    return fnv1a(0xcbf29ce484222325ULL, chip.gfx, screenWords(chip.hires) * sizeof(uint64_t));
+}
+
+uint64_t hashRegisters(const Chip8& chip) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a(hash, chip.V, sizeof(chip.V));
+    hash = fnv1a(hash, &chip.I, sizeof(chip.I));
+    hash = fnv1a(hash, &chip.pc, sizeof(chip.pc));
+    hash = fnv1a(hash, &chip.sp, sizeof(chip.sp));
+    hash = fnv1a(hash, chip.stack, sizeof(chip.stack));
+    hash = fnv1a(hash, &chip.delay_timer, sizeof(chip.delay_timer));
+    hash = fnv1a(hash, &chip.sound_timer, sizeof(chip.sound_timer));
+    return hash;
+}
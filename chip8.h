@@ -0,0 +1,209 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "quirks.h"
+
+struct Aot;
+struct Chip8;
+struct DecodedOp;
+struct Jit;
+class Profiler;
+class TraceRing;
+
+// Executes a decoded instruction at `pc` and returns the next pc
+typedef uint16_t (*OpHandler)(Chip8& chip, const DecodedOp& op, uint16_t pc);
+
+// An instruction decoded once and cached by address, so emulateCycle can
+// jump straight to the handler with its operands already extracted
+struct DecodedOp {
+    OpHandler handler;       // decode-on-first-use stub until the address is decoded
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t x, y, n, nn;
+};
+
+// A write to the sound timer (Fx18), stamped with chip.instructionCount
+struct SoundWrite {
+    uint64_t instruction;
+    uint8_t value;
+};
+
+// Sound timer writes kept for the audio code to pick up after each frame,
+// see logSoundWrite
+const int MAX_SOUND_WRITES = 8;
+
+// The display is 64x32 with one word per row, or 128x64 with two in
+// SUPER-CHIP's hi-res mode
+const int MAX_DISPLAY_WORDS = 128;
+
+struct Chip8 {
+    bool drawFlag; // Set to true if the screen needs to be redrawn
+    uint8_t memory[4096];
+    uint8_t V[16];           // Registers V0 to VF
+    uint16_t I;              // Index register
+    uint16_t pc;             // Program counter
+    uint64_t gfx[MAX_DISPLAY_WORDS]; // Display, packed rows (see Screen), bit 63 of a row's first word is x = 0
+    uint64_t dirtyRows;      // Bit per gfx row changed since the renderer last uploaded it
+    bool hires;              // SUPER-CHIP 128x64 mode (00FF) rather than 64x32 (00FE)
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    SoundWrite soundWrites[MAX_SOUND_WRITES]; // Fx18s that switched the buzzer since the frontend last cleared soundWriteCount
+    uint8_t soundWriteCount;
+    uint16_t stack[16];
+    uint16_t sp;             // Stack pointer
+    uint8_t keypad[16];      // Hex-based keypad (0x0-0xF)
+    uint8_t rplFlags[16];    // SUPER-CHIP user flags, Fx75/Fx85
+    QuirkProfile quirks;     // Platform the ROM expects, see quirks.h and setQuirkProfile
+    bool vblank;             // A timer tick happened since the last draw (for the VIP's DXYN wait)
+    bool drawWait;           // A VIP DXYN drew and is waiting for vblank
+    bool keyWait;            // An FX0A is waiting for a key, see skipIdleLoop
+    uint16_t keyWaitHeld;    // Keys already down when it started, bit per key; they count once released
+    uint16_t keyWaitPressed; // Keys pressed since, the first one released ends the wait
+    uint32_t rng;            // xorshift32 state for CXNN, so runs are reproducible
+    uint64_t instructionCount; // Instructions executed since reset (before the current one while it runs), the clock input logs are keyed by
+    uint64_t frames;         // 60Hz timer ticks since reset
+    uint64_t cycles;         // VIP machine cycles run on the VIP's clock, see runCyclesTimed
+    uint64_t cycleDeadline;  // chip.cycles at which the current timed frame ends
+    bool idleSkip;           // Fast-forward through idle polling loops (on after reset), see skipIdleLoop
+    uint8_t idleFailures;    // Consecutive failed idle loop checks
+    uint16_t idleBackoff;    // Checks to skip before looking for an idle loop again
+
+    Jit* jit;                // Optional recompiler, see jit.h
+    Aot* aot;                // Optional ahead-of-time compiled ROMs, see aot.h
+    TraceRing* trace;        // Only used in -DCHIP8_TRACE builds, see trace.h
+    Profiler* profiler;      // Optional instruction profiler, see profiler.h
+    DecodedOp decoded[4096]; // Decode cache indexed by pc, see writeMemory
+};
+
+// Log an Fx18 of `value` at `instruction`, before it's stored. Only writes
+// that switch the buzzer on or off are kept, and once the log is full the
+// last entry is overwritten, so the frame always ends in the state of the
+// last write.
+inline void logSoundWrite(Chip8& chip, uint64_t instruction, uint8_t value) {
+    if ((chip.sound_timer > 0) == (value > 0)) return;
+    int slot = chip.soundWriteCount < MAX_SOUND_WRITES ? chip.soundWriteCount++ : MAX_SOUND_WRITES - 1;
+    chip.soundWrites[slot] = { instruction, value };
+}
+
+// Clear all state (including any attached Jit), load the font and point pc at 0x200
+void resetChip8(Chip8& chip);
+bool loadROM(const char* filename, Chip8& chip);
+// Largest program that fits between 0x200 and the end of memory
+const size_t MAX_ROM_SIZE = 4096 - 0x200;
+// The small font is at 0, the SUPER-CHIP big one (10 bytes a digit) right after it
+const uint16_t BIG_FONT_ADDRESS = 0x50;
+// Copy a ROM image into memory at 0x200; fails (leaving memory alone) if it doesn't fit
+bool loadROMData(Chip8& chip, const uint8_t* data, size_t size);
+// Seed the CXNN random number generator (0 picks the default seed)
+void seedRandom(Chip8& chip, uint32_t seed);
+
+// Fetch, decode and execute a single instruction
+void emulateCycle(Chip8& chip);
+// Execute `count` instructions back to back, same result as calling emulateCycle `count` times
+void runCycles(Chip8& chip, uint64_t count);
+// If the machine is spinning in a loop that only reads timers, keys and
+// memory and comes back round to the same registers every iteration, the
+// rest of a `count` instruction run (during which timers and keys can't
+// change) would just repeat it: account for those instructions without
+// executing them. Runs at most one iteration otherwise. Returns the number
+// of instructions consumed, executed or skipped. Bit-identical to stepping.
+// An FX0A waiting for a key parks the machine the same way: the whole run
+// is spent on it unless the keypad has changed to end the wait.
+uint64_t skipIdleLoop(Chip8& chip, uint64_t count);
+// Decode a raw opcode into its handler and operands, the handler being the
+// profile's instantiation where quirks apply
+DecodedOp decodeOpcode(uint16_t opcode, QuirkProfile quirks = QuirkProfile::Modern);
+// Switch quirk profile, dropping every decode made for the old one; call
+// it after loading a ROM, reset leaves the Modern profile
+void setQuirkProfile(Chip8& chip, QuirkProfile quirks);
+
+// Every store into chip.memory goes through here so cached decodes of the
+// overwritten bytes are dropped (self-modifying ROMs stay correct)
+void writeMemory(Chip8& chip, uint16_t addr, uint8_t value);
+// Drop every cached decode, e.g. after loading a new ROM
+void invalidateDecodeCache(Chip8& chip);
+// Decrement delay and sound timers and count the frame, called at 60Hz
+void tickTimers(Chip8& chip);
+// Number of instructions in emulated frame `frame`, spreading ips/60's
+// remainder evenly so every second executes exactly `ips` instructions
+uint32_t instructionsForFrame(uint32_t ips, uint64_t frame);
+// Run `count` instructions through the compiled ROM or the Jit if one is
+// attached, otherwise runCycles
+void runInstructions(Chip8& chip, uint64_t count);
+// One 60Hz frame of emulated time: `instructions` instructions (see
+// runInstructions) followed by a timer tick
+void runFrame(Chip8& chip, uint32_t instructions);
+
+// COSMAC VIP timing. The VIP's 1802 runs at 1.76 MHz, 8 clocks a machine
+// cycle, which makes 3668 machine cycles a 60Hz frame; the 1861's display
+// DMA takes 1024 of them, and the interpreter gets the rest.
+const uint32_t VIP_FRAME_CYCLES = 3668 - 1024;
+// A speed of 0 instructions per second (or frame) stands for the VIP's own
+// timing wherever one is given: frames run with runFrameTimed
+const uint32_t IPS_VIP = 0;
+// Machine cycles the VIP's interpreter takes for `opcode` (approximately;
+// DXYN by sprite height, as if drawn on a byte boundary)
+uint32_t vipCycles(uint16_t opcode);
+// Run until the current frame's VIP_FRAME_CYCLES are spent or for `count`
+// instructions, whichever comes first. Starts a new frame if the last one
+// was spent. A VIP DXYN spends the rest of its frame waiting for the
+// display. An FX0A waiting for a key goes round at its own cost in cycles,
+// so a key that comes part way through the frame ends the wait there. Returns true when the frame is spent and it's time to tickTimers.
+// Always interpreted: there's a few hundred instructions a frame at most.
+bool runCyclesTimed(Chip8& chip, uint64_t count);
+// One 60Hz frame on the VIP's clock: runCyclesTimed followed by a timer tick
+void runFrameTimed(Chip8& chip);
+
+// A packed display, the machine's or a batch lane's: `hires ? 64 : 32`
+// rows of `hires ? 2 : 1` words, bit 63 of a row's first word is x = 0.
+// Scrolls move whole words and sprites are shifted into place a row at a
+// time, so a hi-res frame costs about what a lo-res one does.
+struct Screen {
+    uint64_t* gfx;
+    uint64_t* dirtyRows;
+    bool hires;
+};
+
+inline Screen screenOf(Chip8& chip) {
+    return { chip.gfx, &chip.dirtyRows, chip.hires };
+}
+inline int screenWidth(bool hires) { return hires ? 128 : 64; }
+inline int screenHeight(bool hires) { return hires ? 64 : 32; }
+// Words of gfx in use
+inline int screenWords(bool hires) { return hires ? 128 : 32; }
+// dirtyRows with every row of the mode set
+inline uint64_t allRows(bool hires) { return hires ? ~0ULL : 0xFFFFFFFFULL; }
+
+// XOR a sprite onto the screen at (x, y), wrapping the start position and
+// clipping the rest (or wrapping it too, with Wrap for XO-CHIP): `n` rows
+// of 8 pixels, or 16 rows of 16 when n is 0 (DXY0). Returns whether a lit
+// pixel was turned off.
+template <bool Wrap = false>
+bool drawSprite(const Screen& screen, const uint8_t* memory, uint16_t I, uint8_t x, uint8_t y, uint8_t n);
+// Scroll the contents by `n` pixels of the current mode, clearing what scrolls in
+void scrollDown(const Screen& screen, int n);
+void scrollUp(const Screen& screen, int n);
+void scrollRight(const Screen& screen, int n);
+void scrollLeft(const Screen& screen, int n);
+// Switch between 64x32 and 128x64 (00FE/00FF), which clears the screen
+void setHires(Chip8& chip, bool hires);
+
+// Read one pixel of the packed display
+inline bool getPixel(const Chip8& chip, int x, int y) {
+    const uint64_t* row = chip.gfx + (chip.hires ? 2 * y : y);
+    return (row[x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+// FNV-1a hash of arbitrary bytes, e.g. a ROM image
+uint64_t hashData(const void* data, size_t size);
+// Hash of the display words in use, so lo-res hashes don't depend on the hi-res buffer size
+uint64_t hashFramebuffer(const Chip8& chip);
+// Hash of V, I, pc, sp, stack and timers
+uint64_t hashRegisters(const Chip8& chip);
+void printGFX(const Chip8& chip);
+void printRom(const Chip8& chip);
+
+#endif // CHIP8_H
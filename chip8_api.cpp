@@ -0,0 +1,151 @@
+#include "chip8_api.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "batch.h"
+#include "chip8.h"
+#include "thread_pool.h"
+
+static_assert(sizeof(chip8_registers) == sizeof(LaneRegisters) &&
+              offsetof(chip8_registers, I) == offsetof(LaneRegisters, I) &&
+              offsetof(chip8_registers, hires) == offsetof(LaneRegisters, hires) &&
+              offsetof(chip8_registers, instruction_count) == offsetof(LaneRegisters, instructionCount) &&
+              offsetof(chip8_registers, frames) == offsetof(LaneRegisters, frames),
+              "chip8_registers and LaneRegisters must match");
+static_assert(CHIP8_DISPLAY_WORDS == MAX_DISPLAY_WORDS, "observation display size");
+
+// Lanes per group in the batch engine; shards are whole groups
+static const size_t GROUP = 32;
+
+// The instances a shard holds
+struct ShardRange {
+    size_t first;
+    size_t count;
+};
+
+struct chip8_batch {
+    size_t instances = 0;
+    size_t shardLanes = 0;         // instance i is lane i % shardLanes of shard i / shardLanes
+    std::vector<std::unique_ptr<Batch>> shards;
+    std::vector<ShardRange> ranges; // per shard, set up with it
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<Chip8> start;  // the loaded ROM, reset
+    QuirkProfile quirks = QuirkProfile::Modern;
+    uint32_t instructionsPerFrame = 10;
+    uint64_t* displays = nullptr;
+    chip8_registers* registers = nullptr;
+};
+
+// Run `task(shard, first instance, instances)` on every shard in parallel.
+// Nothing is allocated: the pool hands out shard indices.
+template <typename F>
+static void forEachShard(chip8_batch& batch, F task) {
+    auto body = [&batch, &task](size_t s) {
+        task(*batch.shards[s], batch.ranges[s].first, batch.ranges[s].count);
+    };
+    batch.pool->parallelFor(batch.shards.size(), body);
+}
+
+// Fill in the observations of instances [first, first + count), all in `shard`
+static void observeShard(const chip8_batch& batch, const Batch& shard, size_t first, size_t count) {
+    if (!batch.displays && !batch.registers) return;
+    for (size_t i = first; i < first + count; ++i) {
+        shard.observe(i % batch.shardLanes, batch.displays ? batch.displays + i * CHIP8_DISPLAY_WORDS : nullptr,
+                      batch.registers ? (LaneRegisters*)&batch.registers[i] : nullptr);
+    }
+}
+
+static void resetLane(chip8_batch& batch, size_t index, uint32_t seed) {
+    seedRandom(*batch.start, seed);
+    batch.shards[index / batch.shardLanes]->load(index % batch.shardLanes, *batch.start);
+}
+
+extern "C" {
+
+chip8_batch* chip8_batch_create(size_t instances, unsigned threads) {
+    if (instances == 0) return nullptr;
+    std::unique_ptr<chip8_batch> batch(new chip8_batch());
+    batch->instances = instances;
+    batch->pool.reset(threads ? new ThreadPool(threads) : new ThreadPool());
+    // A couple of shards per thread so stragglers even out, each whole groups
+    size_t groups = (instances + GROUP - 1) / GROUP;
+    size_t shards = std::min<size_t>(groups, batch->pool->size() * 2);
+    batch->shardLanes = (groups + shards - 1) / shards * GROUP;
+    for (size_t first = 0; first < instances; first += batch->shardLanes) {
+        size_t count = std::min(batch->shardLanes, instances - first);
+        batch->shards.emplace_back(new Batch(count));
+        batch->ranges.push_back({ first, count });
+    }
+    batch->start.reset(new Chip8());
+    resetChip8(*batch->start);
+    return batch.release();
+}
+
+void chip8_batch_destroy(chip8_batch* batch) {
+    delete batch;
+}
+
+size_t chip8_batch_size(const chip8_batch* batch) {
+    return batch->instances;
+}
+
+int chip8_batch_set_quirks(chip8_batch* batch, const char* profile) {
+    return parseQuirkProfile(profile, batch->quirks) ? 0 : -1;
+}
+
+int chip8_batch_set_speed(chip8_batch* batch, uint32_t instructions_per_frame) {
+    if (instructions_per_frame == 0) return -1;
+    batch->instructionsPerFrame = instructions_per_frame;
+    return 0;
+}
+
+int chip8_batch_load(chip8_batch* batch, const uint8_t* rom, size_t size, uint32_t seed) {
+    resetChip8(*batch->start);
+    if (!loadROMData(*batch->start, rom, size)) return -1;
+    setQuirkProfile(*batch->start, batch->quirks);
+    chip8_batch_reset(batch, seed);
+    return 0;
+}
+
+void chip8_batch_reset(chip8_batch* batch, uint32_t seed) {
+    for (size_t i = 0; i < batch->instances; ++i) {
+        resetLane(*batch, i, seed + (uint32_t)i);
+    }
+    forEachShard(*batch, [batch](Batch& shard, size_t first, size_t count) {
+        observeShard(*batch, shard, first, count);
+    });
+}
+
+int chip8_batch_reset_one(chip8_batch* batch, size_t index, uint32_t seed) {
+    if (index >= batch->instances) return -1;
+    resetLane(*batch, index, seed);
+    observeShard(*batch, *batch->shards[index / batch->shardLanes], index, 1);
+    return 0;
+}
+
+void chip8_batch_set_keys(chip8_batch* batch, const uint16_t* keys) {
+    for (size_t i = 0; i < batch->instances; ++i) {
+        batch->shards[i / batch->shardLanes]->setKeys(i % batch->shardLanes, keys[i]);
+    }
+}
+
+void chip8_batch_observe(chip8_batch* batch, uint64_t* displays, chip8_registers* registers) {
+    batch->displays = displays;
+    batch->registers = registers;
+    forEachShard(*batch, [batch](Batch& shard, size_t first, size_t count) {
+        observeShard(*batch, shard, first, count);
+    });
+}
+
+void chip8_batch_step(chip8_batch* batch, uint32_t frames) {
+    uint32_t instructions = batch->instructionsPerFrame;
+    forEachShard(*batch, [batch, instructions, frames](Batch& shard, size_t first, size_t count) {
+        shard.runFrames(instructions, frames);
+        observeShard(*batch, shard, first, count);
+    });
+}
+
+} // extern "C"
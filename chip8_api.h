@@ -0,0 +1,71 @@
+#ifndef CHIP8_API_H
+#define CHIP8_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C API for driving batches of machines from another process or language,
+// built as a shared library (libchip8, see README).
+//
+// A batch holds `instances` copies of one ROM. They run on the lockstep
+// batch engine (batch.h), split into shards that step in parallel on a
+// thread pool. Observations are written straight into arrays the caller
+// binds once with chip8_batch_observe, by the worker that stepped each
+// instance, so a step allocates and copies nothing else. Functions that can
+// fail return 0 on success and -1 on failure.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Words of display per instance in the observation array. Rows are packed
+// as in the core: one word per row for the 64x32 display (words 0-31 are
+// in use), two for 128x64 hi-res, with bit 63 of a row's first word at x = 0.
+#define CHIP8_DISPLAY_WORDS 128
+
+typedef struct chip8_registers {
+    uint8_t V[16];
+    uint16_t I, pc, sp;
+    uint8_t delay_timer, sound_timer;
+    uint8_t hires;                 // which display layout is in use
+    uint8_t reserved[7];
+    uint64_t instruction_count;
+    uint64_t frames;
+} chip8_registers;
+
+typedef struct chip8_batch chip8_batch;
+
+// `threads` 0 uses every core; null if `instances` is 0
+chip8_batch* chip8_batch_create(size_t instances, unsigned threads);
+void chip8_batch_destroy(chip8_batch* batch);
+size_t chip8_batch_size(const chip8_batch* batch);
+
+// Quirk profile by name (modern, vip, schip or xochip) for the next load
+int chip8_batch_set_quirks(chip8_batch* batch, const char* profile);
+// Instructions per frame (default 10)
+int chip8_batch_set_speed(chip8_batch* batch, uint32_t instructions_per_frame);
+
+// Load a ROM image into every instance and reset them all, instance i
+// seeded with `seed` + i
+int chip8_batch_load(chip8_batch* batch, const uint8_t* rom, size_t size, uint32_t seed);
+// Back to the loaded ROM's start, all of them or one
+void chip8_batch_reset(chip8_batch* batch, uint32_t seed);
+int chip8_batch_reset_one(chip8_batch* batch, size_t index, uint32_t seed);
+
+// Keypad state per instance, a bit per key; read during the call
+void chip8_batch_set_keys(chip8_batch* batch, const uint16_t* keys);
+
+// Arrays that every step (and this call) fills in: `displays` holds
+// CHIP8_DISPLAY_WORDS words per instance, `registers` one per instance.
+// Either may be null; they stay bound until the next call.
+void chip8_batch_observe(chip8_batch* batch, uint64_t* displays, chip8_registers* registers);
+
+// Run `frames` frames (instructions and a timer tick each) on every
+// instance, then fill in the observation arrays
+void chip8_batch_step(chip8_batch* batch, uint32_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIP8_API_H
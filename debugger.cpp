@@ -0,0 +1,342 @@
+#include "debugger.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "chip8.h"
+#include "trace.h"
+
+static const char* const HELP =
+    "  break ADDR [if REG OP VALUE]   stop before ADDR, e.g. `b 0x2a4 if V3 == 5` (REG V0-VF or I, OP == != < > <= >=)\n"
+    "  delete [ADDR]                  remove the breakpoint at ADDR, or all breakpoints and watchpoints\n"
+    "  watch FIRST [LAST]             stop after a store (Fx33, Fx55) to memory FIRST..LAST\n"
+    "  unwatch FIRST [LAST]           stop watching FIRST..LAST\n"
+    "  continue | step | next | pause run on, one instruction, over a call, stop\n"
+    "  regs                           registers and the instruction at pc\n"
+    "  mem ADDR [LEN]                 hex dump of memory\n"
+    "  list [ADDR] [N]                disassemble N instructions from ADDR (default pc)\n"
+    "  info                           breakpoints and watchpoints\n";
+
+bool BreakCondition::holds(const Chip8& chip) const {
+    uint16_t current = reg < 16 ? chip.V[reg] : chip.I;
+    switch (op) {
+        case Eq: return current == value;
+        case Ne: return current != value;
+        case Lt: return current < value;
+        case Gt: return current > value;
+        case Le: return current <= value;
+        case Ge: return current >= value;
+        default: return true;
+    }
+}
+
+Debugger::Debugger() {
+    memset(breakAt, 0, sizeof(breakAt));
+    memset(watched, 0, sizeof(watched));
+}
+
+void Debugger::setBreakpoint(uint16_t pc, const BreakCondition& condition) {
+    pc &= 0xFFF;
+    clearBreakpoint(pc);
+    breakpoints.push_back({ pc, condition });
+    breakAt[pc] = 1;
+}
+
+bool Debugger::clearBreakpoint(uint16_t pc) {
+    pc &= 0xFFF;
+    for (size_t i = 0; i < breakpoints.size(); ++i) {
+        if (breakpoints[i].pc == pc) {
+            breakpoints.erase(breakpoints.begin() + i);
+            breakAt[pc] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Debugger::watch(uint16_t first, uint16_t last) {
+    for (uint32_t addr = first & 0xFFF; addr <= (last & 0xFFFu); ++addr) {
+        watchedCount += !watched[addr];
+        watched[addr] = 1;
+    }
+}
+
+void Debugger::unwatch(uint16_t first, uint16_t last) {
+    for (uint32_t addr = first & 0xFFF; addr <= (last & 0xFFFu); ++addr) {
+        watchedCount -= watched[addr];
+        watched[addr] = 0;
+    }
+}
+
+void Debugger::clearAll() {
+    breakpoints.clear();
+    memset(breakAt, 0, sizeof(breakAt));
+    memset(watched, 0, sizeof(watched));
+    watchedCount = 0;
+}
+
+void Debugger::pause(const char* reason) {
+    stopped = true;
+    stepping = false;
+    overCall = false;
+    stopReason = reason;
+}
+
+void Debugger::resume() {
+    stopped = false;
+    stepping = false;
+    skipBreak = true;
+}
+
+void Debugger::step() {
+    resume();
+    stepping = true;
+}
+
+void Debugger::stepOver(const Chip8& chip) {
+    uint16_t pc = chip.pc & 0xFFF;
+    if ((chip.memory[pc] & 0xF0) != 0x20) {
+        step();
+        return;
+    }
+    resume();
+    overCall = true;
+    returnPc = (pc + 2) & 0xFFF;
+    returnSp = chip.sp;
+}
+
+bool Debugger::breakBefore(const Chip8& chip) {
+    uint16_t pc = chip.pc & 0xFFF;
+    char text[64];
+    if (overCall && pc == returnPc && chip.sp == returnSp) {
+        std::snprintf(text, sizeof(text), "stepped over the call to 0x%03X", returnPc);
+        pause(text);
+        return true;
+    }
+    if (!breakAt[pc] || skipBreak) return false;
+    for (const Breakpoint& breakpoint : breakpoints) {
+        if (breakpoint.pc == pc && breakpoint.condition.holds(chip)) {
+            std::snprintf(text, sizeof(text), "breakpoint at 0x%03X", pc);
+            pause(text);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Debugger::stepOne(Chip8& chip, bool timed) {
+    uint16_t pc = chip.pc & 0xFFF;
+    uint16_t opcode = chip.memory[pc] << 8 | chip.memory[(pc + 1) & 0xFFF];
+
+    // Only Fx33 and Fx55 store to memory
+    int hit = -1;
+    if ((opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055) {
+        int length = (opcode & 0xFF) == 0x33 ? 3 : ((opcode >> 8) & 0xF) + 1;
+        for (int i = 0; i < length && hit < 0; ++i) {
+            if (watched[(chip.I + i) & 0xFFF]) hit = (chip.I + i) & 0xFFF;
+        }
+    }
+
+    bool spent = false;
+    if (timed) spent = runCyclesTimed(chip, 1);
+    else runCycles(chip, 1);
+    skipBreak = false;
+
+    char text[64];
+    if (hit >= 0) {
+        std::snprintf(text, sizeof(text), "store to watched 0x%03X by 0x%03X", hit, pc);
+        pause(text);
+    } else if (stepping) {
+        pause("stepped");
+    }
+    return spent;
+}
+
+template <bool Timed>
+uint64_t Debugger::runLoop(Chip8& chip, uint64_t count, bool& spent) {
+    const uint64_t first = chip.instructionCount;
+    spent = false;
+    while (!stopped && (Timed || chip.instructionCount - first < count)) {
+        if (breakBefore(chip)) break;
+        spent = stepOne(chip, Timed);
+        if (spent) break;
+    }
+    return chip.instructionCount - first;
+}
+
+uint64_t Debugger::run(Chip8& chip, uint64_t count) {
+    bool spent;
+    return runLoop<false>(chip, count, spent);
+}
+
+bool Debugger::runFrame(Chip8& chip, uint32_t instructions) {
+    if (stopped) return false;
+    if (!inFrame && !armed()) {
+        if (instructions == IPS_VIP) ::runFrameTimed(chip);
+        else ::runFrame(chip, instructions);
+        skipBreak = false;
+        return true;
+    }
+    if (!inFrame) {
+        inFrame = true;
+        frameTimed = instructions == IPS_VIP;
+        frameLeft = instructions;
+    }
+    if (frameTimed) {
+        bool spent;
+        runLoop<true>(chip, 0, spent);
+        if (!spent) return false;
+    } else {
+        frameLeft -= (uint32_t)run(chip, frameLeft);
+        if (frameLeft > 0) return false;
+    }
+    inFrame = false;
+    tickTimers(chip);
+    return true;
+}
+
+void Debugger::printState(const Chip8& chip, std::ostream& out) const {
+    char line[256];
+    int length = std::snprintf(line, sizeof(line), "pc=%03X I=%03X sp=%X dt=%02X st=%02X ", chip.pc & 0xFFF, chip.I,
+                               chip.sp, chip.delay_timer, chip.sound_timer);
+    for (int r = 0; r < 16; ++r) {
+        length += std::snprintf(line + length, sizeof(line) - length, "V%X=%02X ", r, chip.V[r]);
+    }
+    uint16_t pc = chip.pc & 0xFFF;
+    uint16_t opcode = chip.memory[pc] << 8 | chip.memory[(pc + 1) & 0xFFF];
+    char text[32];
+    disassemble(opcode, text, sizeof(text));
+    std::snprintf(line + length, sizeof(line) - length, "| %04X  %s\n", opcode, text);
+    out << line;
+}
+
+static bool parseNumber(const std::string& word, uint32_t& value) {
+    if (word.empty()) return false;
+    char* end = nullptr;
+    value = (uint32_t)std::strtoul(word.c_str(), &end, 0);
+    return *end == '\0';
+}
+
+static bool parseCondition(std::istringstream& in, BreakCondition& condition) {
+    std::string reg, op, value;
+    if (!(in >> reg >> op >> value)) return false;
+    uint32_t number;
+    if (reg == "I" || reg == "i") {
+        condition.reg = 16;
+    } else if (reg.size() == 2 && (reg[0] == 'V' || reg[0] == 'v') && std::isxdigit((unsigned char)reg[1])) {
+        condition.reg = (uint8_t)std::strtoul(reg.c_str() + 1, nullptr, 16);
+    } else {
+        return false;
+    }
+    static const char* const ops[] = { "==", "!=", "<", ">", "<=", ">=" };
+    condition.op = BreakCondition::Always;
+    for (int i = 0; i < 6; ++i) {
+        if (op == ops[i]) condition.op = (BreakCondition::Op)(BreakCondition::Eq + i);
+    }
+    if (condition.op == BreakCondition::Always || !parseNumber(value, number)) return false;
+    condition.value = (uint16_t)number;
+    return true;
+}
+
+bool Debugger::command(Chip8& chip, const std::string& line, std::ostream& out) {
+    std::istringstream in(line);
+    std::string verb, first, second;
+    in >> verb;
+    uint32_t a = 0, b = 0;
+
+    if (verb.empty()) {
+        return true;
+    } else if (verb == "help" || verb == "h") {
+        out << HELP;
+    } else if (verb == "break" || verb == "b") {
+        BreakCondition condition;
+        std::string keyword;
+        if (!(in >> first) || !parseNumber(first, a) || ((in >> keyword) && (keyword != "if" || !parseCondition(in, condition)))) {
+            out << "usage: break ADDR [if REG OP VALUE]\n";
+            return true;
+        }
+        setBreakpoint((uint16_t)a, condition);
+    } else if (verb == "delete" || verb == "d") {
+        if (!(in >> first)) clearAll();
+        else if (!parseNumber(first, a) || !clearBreakpoint((uint16_t)a)) out << "no breakpoint at " << first << "\n";
+    } else if (verb == "watch" || verb == "w" || verb == "unwatch") {
+        if (!(in >> first) || !parseNumber(first, a) || ((in >> second) && !parseNumber(second, b))) {
+            out << "usage: " << verb << " FIRST [LAST]\n";
+            return true;
+        }
+        if (second.empty()) b = a;
+        if (verb == "unwatch") unwatch((uint16_t)a, (uint16_t)b);
+        else watch((uint16_t)a, (uint16_t)b);
+    } else if (verb == "continue" || verb == "c") {
+        resume();
+    } else if (verb == "step" || verb == "s") {
+        step();
+    } else if (verb == "next" || verb == "n") {
+        stepOver(chip);
+    } else if (verb == "pause" || verb == "p") {
+        pause();
+        printState(chip, out);
+    } else if (verb == "regs" || verb == "r") {
+        printState(chip, out);
+    } else if (verb == "mem" || verb == "x") {
+        b = 64;
+        if (!(in >> first) || !parseNumber(first, a) || ((in >> second) && !parseNumber(second, b))) {
+            out << "usage: mem ADDR [LEN]\n";
+            return true;
+        }
+        char text[16];
+        for (uint32_t i = 0; i < b; ++i) {
+            uint16_t addr = (a + i) & 0xFFF;
+            if (i % 16 == 0) {
+                std::snprintf(text, sizeof(text), "%s%03X:", i ? "\n" : "", addr);
+                out << text;
+            }
+            std::snprintf(text, sizeof(text), " %02X", chip.memory[addr]);
+            out << text;
+        }
+        out << "\n";
+    } else if (verb == "list" || verb == "l") {
+        a = chip.pc & 0xFFF;
+        b = 8;
+        if (((in >> first) && !parseNumber(first, a)) || ((in >> second) && !parseNumber(second, b))) {
+            out << "usage: list [ADDR] [N]\n";
+            return true;
+        }
+        char text[64], mnemonic[32];
+        for (uint32_t i = 0; i < b; ++i) {
+            uint16_t addr = (a + 2 * i) & 0xFFF;
+            uint16_t opcode = chip.memory[addr] << 8 | chip.memory[(addr + 1) & 0xFFF];
+            disassemble(opcode, mnemonic, sizeof(mnemonic));
+            std::snprintf(text, sizeof(text), "%s%c%03X: %04X  %s\n", addr == (chip.pc & 0xFFF) ? ">" : " ",
+                          breakAt[addr] ? '*' : ' ', addr, opcode, mnemonic);
+            out << text;
+        }
+    } else if (verb == "info" || verb == "i") {
+        static const char* const ops[] = { "", "==", "!=", "<", ">", "<=", ">=" };
+        for (const Breakpoint& breakpoint : breakpoints) {
+            out << "break 0x" << std::hex << breakpoint.pc;
+            const BreakCondition& condition = breakpoint.condition;
+            if (condition.op != BreakCondition::Always) {
+                out << " if " << (condition.reg < 16 ? "V" : "I");
+                if (condition.reg < 16) out << std::uppercase << (int)condition.reg << std::nouppercase;
+                out << " " << ops[condition.op] << " 0x" << condition.value;
+            }
+            out << std::dec << "\n";
+        }
+        for (uint32_t addr = 0; addr < 4096; ++addr) {
+            if (!watched[addr]) continue;
+            uint32_t last = addr;
+            while (last + 1 < 4096 && watched[last + 1]) last++;
+            out << "watch 0x" << std::hex << addr << " 0x" << last << std::dec << "\n";
+            addr = last;
+        }
+    } else {
+        out << "unknown command: " << verb << " (try help)\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+struct Chip8;
+
+// Interactive debugger.
+//
+// A frontend with a Debugger runs frames through Debugger::runFrame instead
+// of runFrame. While a breakpoint, watchpoint or step is set that swaps in
+// its own dispatch loop, one instruction at a time through runCycles, which
+// checks a bitmap of breakpoint addresses before every instruction and the
+// watchpoint bitmap only before the two opcodes that store to memory, Fx33
+// and Fx55. With none it's plain runFrame, so the usual fast paths (Jit,
+// compiled ROMs, idle loop skipping) run untouched. The core itself knows
+// nothing about it.
+//
+// It is driven by text commands (see command, or `help`), typed at the
+// headless runner's prompt or on the SDL frontend's terminal.
+
+// Condition on a breakpoint: `reg op value`, reg being V0-VF or I
+struct BreakCondition {
+    enum Op : uint8_t { Always, Eq, Ne, Lt, Gt, Le, Ge };
+    Op op = Always;
+    uint8_t reg = 0;         // 0-15 for V0-VF, 16 for I
+    uint16_t value = 0;
+
+    bool holds(const Chip8& chip) const;
+};
+
+class Debugger {
+public:
+    Debugger();
+
+    void setBreakpoint(uint16_t pc, const BreakCondition& condition = BreakCondition());
+    bool clearBreakpoint(uint16_t pc);
+    // Stop after any store to [first, last]
+    void watch(uint16_t first, uint16_t last);
+    void unwatch(uint16_t first, uint16_t last);
+    void clearAll();
+
+    void pause(const char* reason = "paused");
+    void resume();
+    // Run one instruction and pause again, or to the instruction after a
+    // 2NNN once its subroutine has returned
+    void step();
+    void stepOver(const Chip8& chip);
+    bool paused() const { return stopped; }
+    // Why it last stopped, e.g. "breakpoint at 0x2A4"
+    const std::string& reason() const { return stopReason; }
+
+    // Run up to `count` instructions, stopping early before an instruction
+    // at a breakpoint whose condition holds, after a store to a watched
+    // byte, or at the end of a step. Returns the number run.
+    uint64_t run(Chip8& chip, uint64_t count);
+    // runFrame, but stopping like run: `instructions` instructions (or the
+    // VIP's cycle budget for IPS_VIP) and a timer tick. A frame that stops
+    // part way through carries on from there at the next call, which
+    // ignores `instructions`. Returns true if the frame was finished.
+    bool runFrame(Chip8& chip, uint32_t instructions);
+    // Anything that could stop a run: with nothing armed runFrame is runFrame
+    bool armed() const { return !breakpoints.empty() || watchedCount || stepping || overCall; }
+
+    // Carry out one command line, writing any output to `out`. Returns
+    // false for one it doesn't know (after saying so).
+    bool command(Chip8& chip, const std::string& line, std::ostream& out);
+    // Registers and the instruction at pc on one line
+    void printState(const Chip8& chip, std::ostream& out) const;
+
+private:
+    struct Breakpoint {
+        uint16_t pc;
+        BreakCondition condition;
+    };
+
+    // Whether to stop before executing the instruction at chip.pc
+    bool breakBefore(const Chip8& chip);
+    // Step one instruction, checking watchpoints if it stores; run() with
+    // `timed` steps with runCyclesTimed, and returns when the frame is spent
+    bool stepOne(Chip8& chip, bool timed);
+    template <bool Timed>
+    uint64_t runLoop(Chip8& chip, uint64_t count, bool& spent);
+
+    uint8_t breakAt[4096];       // an enabled breakpoint at the address
+    uint8_t watched[4096];
+    uint32_t watchedCount = 0;   // bytes set in watched
+    std::vector<Breakpoint> breakpoints;
+    bool stopped = false;
+    bool skipBreak = false;      // resuming from a breakpoint: don't stop on it again straight away
+    bool stepping = false;       // stop after the next instruction
+    bool overCall = false;       // stepping over a 2NNN: stop at returnPc with the stack back at returnSp
+    uint16_t returnPc = 0, returnSp = 0;
+    std::string stopReason;
+    bool inFrame = false;        // a frame was stopped part way through
+    uint32_t frameLeft = 0;      // and that many instructions are left of it
+    bool frameTimed = false;     // or it runs on the VIP's cycle budget
+};
+
+#endif // DEBUGGER_H
@@ -0,0 +1,553 @@
+// Headless runner: executes a ROM without SDL and reports interpreter throughput.
+//
+//   chip8_headless <rom> [--cycles N | --frames N] [--ipf N|vip] [--timers frame|wall|off] [--jit | --aot]
+//                        [--quirks modern|vip|schip|xochip]
+//   chip8_headless --bench [--cycles N] [--jit | --aot] [--no-idle-skip]
+//
+//   chip8_headless --replay FILE [--seek N] [--jit | --aot]
+//   chip8_headless <rom> --batch N [--verify] [--cycles N | --frames N] [--ipf N]
+//   chip8_headless <rom> --debug [--cycles N | --frames N] [--ipf N|vip]
+//
+// --load-state FILE starts from a save state instead of the ROM's entry point,
+// --save-state FILE writes the final state. --replay plays back an input log
+// recorded by the SDL frontend (--record) at full speed, to its end or to
+// instruction --seek N. --profile FILE writes opcode, hot pc/loop and timing
+// counters as JSON (or CSV for a .csv path). --wav FILE renders the buzzer
+// to a WAV file, one emulated frame of samples per frame (--timers frame),
+// and --capture FILE the display to video (capture.h), a frame per frame.
+// --batch N runs N copies of the ROM in lockstep (batch.h), each with its own
+// CXNN seed, and reports the aggregate rate; --verify also runs every copy on
+// its own and checks they end up identical. --aot runs ROMs that were
+// compiled in by chip8_aotc (aot.h) through their compiled code. --quirks
+// runs ROMs with another quirk profile (quirks.h) than the default modern.
+// --ipf vip runs frames on the COSMAC VIP's clock instead (runFrameTimed),
+// interpreted, with frame timers. --debug starts the ROM paused at a
+// debugger prompt (debugger.h); each continue runs up to --cycles
+// instructions or --frames frames unless something stops it first.
+//
+// Built with -DCHIP8_TRACE, --trace FILE records the last instructions to a
+// binary trace for chip8_tracedump.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "aot.h"
+#include "audio.h"
+#include "batch.h"
+#include "capture.h"
+#include "chip8.h"
+#include "debugger.h"
+#include "jit.h"
+#include "profiler.h"
+#include "replay.h"
+#include "savestate.h"
+#include "trace.h"
+
+enum class TimerMode {
+    Frame, // tick timers every `ipf` instructions (emulated 60Hz)
+    Wall,  // tick timers every 16ms of host time, like the SDL loop
+    Off    // never tick timers
+};
+
+struct RunConfig {
+    uint64_t cycles = 1000000;
+    uint64_t frames = 0;     // if set, overrides cycles with frames * ipf
+    uint32_t ipf = 10;       // instructions per 60Hz frame, IPS_VIP for the VIP's cycle budget
+    TimerMode timers = TimerMode::Frame;
+    bool jit = false;        // run through the recompiler instead of the interpreter
+    bool aot = false;        // run compiled-in ROMs through their ahead-of-time code
+    uint32_t seed = 0;       // CXNN seed, 0 for the default
+    bool idleSkip = true;    // fast-forward idle loops (see skipIdleLoop), off to measure raw dispatch
+    QuirkProfile quirks = QuirkProfile::Modern;
+};
+
+struct RunResult {
+    uint64_t instructions;
+    double seconds;
+    uint64_t fbHash;
+};
+
+// --ipf vip: each frame runs until its VIP cycles are spent, --cycles stops
+// mid-frame
+static RunResult runHeadlessTimed(Chip8& chip, const RunConfig& cfg, WavWriter* wav, VideoCapture* capture) {
+    using clock = std::chrono::steady_clock;
+    const uint64_t first = chip.instructionCount;
+
+    auto start = clock::now();
+    Buzzer buzzer;
+    if (wav) buzzer.sampleRate = wav->sampleRate;
+    std::vector<int16_t> samples;
+    for (uint64_t frame = 0; cfg.frames ? frame < cfg.frames : chip.instructionCount - first < cfg.cycles; ++frame) {
+        uint64_t frameStart = chip.instructionCount;
+        bool soundOn = chip.sound_timer > 0;
+        bool spent;
+        {
+            ScopedTimer timer(chip.profiler ? &chip.profiler->emulate : nullptr);
+            spent = runCyclesTimed(chip, cfg.frames ? UINT64_MAX : cfg.cycles - (chip.instructionCount - first));
+        }
+        if (wav) {
+            samples.clear();
+            renderBuzzerFrame(buzzer, chip, frameStart, (uint32_t)(chip.instructionCount - frameStart), soundOn, samples);
+            writeWav(*wav, samples.data(), samples.size());
+        }
+        if (spent) {
+            tickTimers(chip);
+            if (capture) capture->push(chip.gfx, chip.hires);
+        }
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    return { chip.instructionCount - first, seconds, hashFramebuffer(chip) };
+}
+
+static RunResult runHeadless(Chip8& chip, const RunConfig& cfg, WavWriter* wav = nullptr,
+                             VideoCapture* capture = nullptr) {
+    if (cfg.ipf == IPS_VIP) return runHeadlessTimed(chip, cfg, wav, capture);
+    using clock = std::chrono::steady_clock;
+    uint64_t budget = cfg.frames ? cfg.frames * cfg.ipf : cfg.cycles;
+    uint64_t executed = 0;
+
+    auto start = clock::now();
+    auto lastTimerUpdate = start;
+    Buzzer buzzer;
+    if (wav) buzzer.sampleRate = wav->sampleRate;
+    std::vector<int16_t> samples;
+    while (executed < budget) {
+        uint64_t n = std::min<uint64_t>(cfg.ipf, budget - executed);
+        uint64_t frameStart = chip.instructionCount;
+        bool soundOn = chip.sound_timer > 0;
+        {
+            ScopedTimer timer(chip.profiler ? &chip.profiler->emulate : nullptr);
+            if (cfg.aot) {
+                aotRunCycles(chip, n);
+            } else if (cfg.jit) {
+                jitRunCycles(chip, n);
+            } else {
+                runCycles(chip, n);
+            }
+        }
+        executed += n;
+        if (wav) {
+            samples.clear();
+            renderBuzzerFrame(buzzer, chip, frameStart, (uint32_t)n, soundOn, samples);
+            writeWav(*wav, samples.data(), samples.size());
+        }
+        if (capture) capture->push(chip.gfx, chip.hires);
+
+        if (cfg.timers == TimerMode::Frame) {
+            tickTimers(chip);
+        } else if (cfg.timers == TimerMode::Wall) {
+            auto now = clock::now();
+            if (now - lastTimerUpdate >= std::chrono::milliseconds(16)) {
+                tickTimers(chip);
+                lastTimerUpdate = now;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    return { executed, seconds, hashFramebuffer(chip) };
+}
+
+static void printResult(const std::string& name, const RunResult& r) {
+    double ips = r.seconds > 0 ? r.instructions / r.seconds : 0;
+    double nsPerInstr = r.instructions ? r.seconds * 1e9 / r.instructions : 0;
+    std::printf("%-60s %12llu instr %10.2f Minstr/s %8.2f ns/instr  fb %016llx\n",
+                name.c_str(), (unsigned long long)r.instructions, ips / 1e6, nsPerInstr,
+                (unsigned long long)r.fbHash);
+}
+
+// Runs each ROM `repeats` times and keeps the fastest run
+static int runBenchmark(RunConfig cfg, int repeats) {
+    std::vector<std::string> roms = {
+        "roms/3-corax+.ch8",
+        "roms/4-flags.ch8",
+        "roms/5-quirks.ch8",
+    };
+    std::vector<std::string> games;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator("roms/games", ec)) {
+        if (entry.path().extension() == ".ch8") games.push_back(entry.path().string());
+    }
+    std::sort(games.begin(), games.end());
+    roms.insert(roms.end(), games.begin(), games.end());
+
+    // Keep the suite's own output readable
+    std::cout.setstate(std::ios::failbit);
+    std::cerr.setstate(std::ios::failbit);
+
+    Jit* jit = cfg.jit ? createJit() : nullptr;
+    Aot* aot = cfg.aot ? createAot() : nullptr;
+    uint64_t totalInstructions = 0;
+    double totalSeconds = 0;
+    for (const auto& rom : roms) {
+        RunResult best{};
+        for (int i = 0; i < repeats; ++i) {
+            Chip8 chip;
+            resetChip8(chip);
+            attachJit(chip, jit);
+            attachAot(chip, aot);
+            chip.idleSkip = cfg.idleSkip;
+            if (!loadROM(rom.c_str(), chip)) break;
+            setQuirkProfile(chip, cfg.quirks);
+            RunResult r = runHeadless(chip, cfg);
+            if (i == 0 || r.seconds < best.seconds) best = r;
+        }
+        if (!best.instructions) {
+            std::fprintf(stderr, "Failed to load ROM: %s\n", rom.c_str());
+            continue;
+        }
+        printResult(rom, best);
+        totalInstructions += best.instructions;
+        totalSeconds += best.seconds;
+    }
+
+    destroyJit(jit);
+    destroyAot(aot);
+    std::cout.clear();
+    std::cerr.clear();
+    printResult("TOTAL", { totalInstructions, totalSeconds, 0 });
+    return 0;
+}
+
+// Plays an input log back as fast as possible; the instruction stream is
+// identical on every run, which makes it a stable perf workload as well
+static int runReplayFile(const char* path, uint64_t seek, const RunConfig& cfg, const char* saveStatePath) {
+    InputLog log;
+    if (!loadInputLog(log, path)) {
+        std::cerr << "Failed to load input log: " << path << "\n";
+        return 1;
+    }
+
+    Jit* jit = cfg.jit ? createJit() : nullptr;
+    Aot* aot = cfg.aot ? createAot() : nullptr;
+    Chip8 chip;
+    resetChip8(chip);
+    attachJit(chip, jit);
+    attachAot(chip, aot);
+    chip.idleSkip = cfg.idleSkip;
+    Replay replay;
+    if (!beginReplay(replay, chip, log)) {
+        std::cerr << "Input log has an incompatible save state: " << path << "\n";
+        destroyJit(jit);
+        destroyAot(aot);
+        return 1;
+    }
+    uint64_t first = chip.instructionCount;
+
+    std::cout.setstate(std::ios::failbit);
+    std::cerr.setstate(std::ios::failbit);
+    auto start = std::chrono::steady_clock::now();
+    runReplay(replay, chip, seek);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.clear();
+    std::cerr.clear();
+
+    printResult(path, { chip.instructionCount - first, seconds, hashFramebuffer(chip) });
+    std::printf("at instruction %llu, frame %llu, registers %016llx\n",
+                (unsigned long long)chip.instructionCount, (unsigned long long)chip.frames,
+                (unsigned long long)hashRegisters(chip));
+    destroyJit(jit);
+    destroyAot(aot);
+    if (saveStatePath && !saveStateToFile(chip, saveStatePath)) {
+        std::cerr << "Failed to write state: " << saveStatePath << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Everything the batch engine carries for a machine
+static bool sameMachine(const Chip8& a, const Chip8& b) {
+    return memcmp(a.memory, b.memory, sizeof(a.memory)) == 0 && memcmp(a.gfx, b.gfx, sizeof(a.gfx)) == 0 &&
+           hashRegisters(a) == hashRegisters(b) && a.rng == b.rng && a.dirtyRows == b.dirtyRows &&
+           a.hires == b.hires && memcmp(a.rplFlags, b.rplFlags, sizeof(a.rplFlags)) == 0 &&
+           a.quirks == b.quirks && a.vblank == b.vblank && a.drawWait == b.drawWait &&
+           a.keyWait == b.keyWait && a.keyWaitHeld == b.keyWaitHeld && a.keyWaitPressed == b.keyWaitPressed &&
+           a.instructionCount == b.instructionCount && a.frames == b.frames;
+}
+
+static int runBatch(const char* romPath, size_t lanes, const RunConfig& cfg, bool verify) {
+    if (cfg.timers == TimerMode::Wall) {
+        std::cerr << "--batch needs --timers frame or off\n";
+        return 1;
+    }
+    if (cfg.ipf == IPS_VIP) {
+        std::cerr << "--batch needs a number for --ipf\n";
+        return 1;
+    }
+    std::unique_ptr<Chip8> chip(new Chip8());
+    resetChip8(*chip);
+    if (!loadROM(romPath, *chip)) return 1;
+    setQuirkProfile(*chip, cfg.quirks);
+
+    Batch batch(lanes);
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        seedRandom(*chip, cfg.seed + (uint32_t)lane);
+        batch.load(lane, *chip);
+    }
+
+    uint64_t budget = cfg.frames ? cfg.frames * cfg.ipf : cfg.cycles;
+    auto start = std::chrono::steady_clock::now();
+    if (cfg.timers == TimerMode::Frame) {
+        batch.runFrames(cfg.ipf, budget / cfg.ipf);
+        if (budget % cfg.ipf) batch.runFrames(budget % cfg.ipf);
+    } else {
+        batch.run(budget);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    batch.store(0, *chip);
+    printResult(std::string(romPath) + " x" + std::to_string(lanes), { budget * lanes, seconds, hashFramebuffer(*chip) });
+    std::printf("%s kernels, %.1f%% of lane-instructions vectorized\n", Batch::simd() ? "AVX2" : "scalar",
+                budget ? 100.0 * batch.vectorized() / (budget * lanes) : 0.0);
+    if (!verify) return 0;
+
+    std::cout.setstate(std::ios::failbit);
+    std::cerr.setstate(std::ios::failbit);
+    std::unique_ptr<Chip8> reference(new Chip8());
+    size_t mismatches = 0;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        resetChip8(*reference);
+        loadROM(romPath, *reference);
+        setQuirkProfile(*reference, cfg.quirks);
+        seedRandom(*reference, cfg.seed + (uint32_t)lane);
+        for (uint64_t executed = 0; executed < budget; executed += cfg.ipf) {
+            runCycles(*reference, std::min<uint64_t>(cfg.ipf, budget - executed));
+            if (cfg.timers == TimerMode::Frame) tickTimers(*reference);
+        }
+        batch.store(lane, *chip);
+        if (!sameMachine(*chip, *reference)) mismatches++;
+    }
+    std::cout.clear();
+    std::cerr.clear();
+    std::printf("verify: %zu of %zu lanes differ from runCycles\n", mismatches, lanes);
+    return mismatches ? 1 : 0;
+}
+
+static int runDebugger(Chip8& chip, const RunConfig& cfg) {
+    Debugger debugger;
+    debugger.pause();
+    debugger.printState(chip, std::cout);
+    std::string line;
+    while (std::cout << "(chip8) " << std::flush, std::getline(std::cin, line)) {
+        if (line == "quit" || line == "q") break;
+        debugger.command(chip, line, std::cout);
+        if (debugger.paused()) continue;
+
+        const uint64_t firstInstruction = chip.instructionCount;
+        for (uint64_t frame = 0; !debugger.paused();) {
+            if (debugger.runFrame(chip, cfg.ipf)) frame++;
+            if (cfg.frames ? frame >= cfg.frames : chip.instructionCount - firstInstruction >= cfg.cycles) {
+                debugger.pause("end of run");
+            }
+        }
+        std::cout << debugger.reason() << "\n";
+        debugger.printState(chip, std::cout);
+    }
+    return 0;
+}
+
+static void usage() {
+    std::cerr << "usage: chip8_headless <rom> [--cycles N | --frames N] [--ipf N|vip] [--timers frame|wall|off] [--jit | --aot] [--no-idle-skip]\n"
+              << "                      [--quirks modern|vip|schip|xochip] [--seed N] [--load-state FILE] [--save-state FILE] [--profile FILE] [--wav FILE]\n"
+              << "                      [--capture FILE.y4m|.gray|.rgb]\n"
+              << "       chip8_headless <rom> --debug [--cycles N | --frames N] [--ipf N|vip]\n"
+              << "       chip8_headless <rom> --batch N [--verify] [--cycles N | --frames N] [--ipf N] [--quirks P] [--seed N]\n"
+              << "       chip8_headless --replay FILE [--seek N] [--jit | --aot] [--save-state FILE]\n"
+              << "       chip8_headless --bench [--cycles N] [--repeat N] [--jit | --aot] [--quirks P] [--no-idle-skip]\n";
+}
+
+int main(int argc, char* argv[]) {
+    RunConfig cfg;
+    const char* romPath = nullptr;
+    const char* tracePath = nullptr;
+    const char* loadStatePath = nullptr;
+    const char* saveStatePath = nullptr;
+    const char* replayPath = nullptr;
+    const char* profilePath = nullptr;
+    const char* wavPath = nullptr;
+    const char* capturePath = nullptr;
+    uint64_t seek = UINT64_MAX;
+    size_t batchLanes = 0;
+    bool verify = false;
+    bool bench = false;
+    bool debug = false;
+    int repeats = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--trace" && hasValue) {
+            tracePath = argv[++i];
+        } else if (arg == "--load-state" && hasValue) {
+            loadStatePath = argv[++i];
+        } else if (arg == "--save-state" && hasValue) {
+            saveStatePath = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            replayPath = argv[++i];
+        } else if (arg == "--seek" && hasValue) {
+            seek = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--profile" && hasValue) {
+            profilePath = argv[++i];
+        } else if (arg == "--batch" && hasValue) {
+            batchLanes = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--wav" && hasValue) {
+            wavPath = argv[++i];
+        } else if (arg == "--capture" && hasValue) {
+            capturePath = argv[++i];
+        } else if (arg == "--seed" && hasValue) {
+            cfg.seed = std::strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--quirks" && hasValue) {
+            if (!parseQuirkProfile(argv[++i], cfg.quirks)) { usage(); return 1; }
+        } else if (arg == "--jit") {
+            cfg.jit = true;
+        } else if (arg == "--aot") {
+            cfg.aot = true;
+        } else if (arg == "--no-idle-skip") {
+            cfg.idleSkip = false;
+        } else if (arg == "--interpreter") {
+            cfg.jit = false;
+            cfg.aot = false;
+        } else if (arg == "--cycles" && hasValue) {
+            cfg.cycles = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--frames" && hasValue) {
+            cfg.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--ipf" && hasValue) {
+            std::string ipf = argv[++i];
+            cfg.ipf = ipf == "vip" ? IPS_VIP : std::max(1ul, std::strtoul(ipf.c_str(), nullptr, 10));
+        } else if (arg == "--repeat" && hasValue) {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--timers" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "frame") cfg.timers = TimerMode::Frame;
+            else if (mode == "wall") cfg.timers = TimerMode::Wall;
+            else if (mode == "off") cfg.timers = TimerMode::Off;
+            else { usage(); return 1; }
+        } else if (arg[0] != '-' && !romPath) {
+            romPath = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+#ifndef CHIP8_TRACE
+    if (tracePath) {
+        std::cerr << "--trace needs a build with -DCHIP8_TRACE\n";
+        return 1;
+    }
+#endif
+
+    if (cfg.ipf == IPS_VIP && cfg.timers != TimerMode::Frame) {
+        std::cerr << "--ipf vip needs --timers frame\n";
+        return 1;
+    }
+    if (wavPath && cfg.timers != TimerMode::Frame) {
+        std::cerr << "--wav needs --timers frame\n";
+        return 1;
+    }
+    if (capturePath && cfg.timers != TimerMode::Frame) {
+        std::cerr << "--capture needs --timers frame\n";
+        return 1;
+    }
+
+    if (bench) return runBenchmark(cfg, repeats);
+    if (replayPath) return runReplayFile(replayPath, seek, cfg, saveStatePath);
+    if (!romPath) {
+        usage();
+        return 1;
+    }
+    if (batchLanes) return runBatch(romPath, batchLanes, cfg, verify);
+
+    Jit* jit = cfg.jit ? createJit() : nullptr;
+    Aot* aot = cfg.aot ? createAot() : nullptr;
+    Chip8 chip;
+    resetChip8(chip);
+    attachJit(chip, jit);
+    attachAot(chip, aot);
+    chip.idleSkip = cfg.idleSkip;
+    if (!loadROM(romPath, chip)) return 1;
+    setQuirkProfile(chip, cfg.quirks);
+    if (aot && !aotProgram(*aot)) {
+        std::cerr << "No compiled program for " << romPath << " (" << aotProgramCount()
+                  << " linked in), running it interpreted\n";
+    }
+    seedRandom(chip, cfg.seed);
+    if (loadStatePath && !loadStateFromFile(chip, loadStatePath)) {
+        std::cerr << "Failed to load state: " << loadStatePath << "\n";
+        return 1;
+    }
+    if (debug) return runDebugger(chip, cfg);
+#ifdef CHIP8_TRACE
+    TraceRing trace;
+    if (tracePath) chip.trace = &trace;
+#endif
+    std::unique_ptr<Profiler> profiler;
+    if (profilePath) {
+        profiler.reset(new Profiler());
+        chip.profiler = profiler.get();
+    }
+    WavWriter wav;
+    if (wavPath && !openWav(wav, wavPath, 48000)) {
+        std::cerr << "Failed to open WAV file: " << wavPath << "\n";
+        return 1;
+    }
+    // Nothing to keep time with here, so every frame is written
+    VideoCapture capture;
+    if (capturePath && !capture.open(capturePath, captureFormatFor(capturePath), true)) {
+        std::cerr << "Failed to open capture file: " << capturePath << "\n";
+        return 1;
+    }
+
+    // The core logs unknown opcodes to stdout/stderr; keep the report clean
+    std::cout.setstate(std::ios::failbit);
+    std::cerr.setstate(std::ios::failbit);
+    RunResult r = runHeadless(chip, cfg, wavPath ? &wav : nullptr, capturePath ? &capture : nullptr);
+    std::cout.clear();
+    std::cerr.clear();
+
+    printResult(romPath, r);
+    if (wavPath && !closeWav(wav)) {
+        std::cerr << "Failed to write WAV file: " << wavPath << "\n";
+        return 1;
+    }
+    if (capturePath) {
+        if (!capture.close()) {
+            std::cerr << "Failed to write capture file: " << capturePath << "\n";
+            return 1;
+        }
+        std::cout << "captured " << capture.written() << " frames (" << capture.repeated() << " repeats) to "
+                  << capturePath << "\n";
+    }
+    if (profiler && !profiler->save(profilePath)) {
+        std::cerr << "Failed to write profile: " << profilePath << "\n";
+        return 1;
+    }
+    if (saveStatePath && !saveStateToFile(chip, saveStatePath)) {
+        std::cerr << "Failed to write state: " << saveStatePath << "\n";
+        return 1;
+    }
+#ifdef CHIP8_TRACE
+    if (tracePath && !trace.save(tracePath)) {
+        std::cerr << "Failed to write trace: " << tracePath << "\n";
+        return 1;
+    }
+#endif
+    destroyJit(jit);
+    destroyAot(aot);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Keypad input from the host, as timestamped events.
+//
+// The frontend stamps each change with the time it happened and pushes it
+// into a KeyQueue; the emulation thread applies it part way through the
+// frame that covers that time (see emulationLoop), rather than at the start
+// of whichever frame next happens to look at the keys. A press and release
+// within one frame are both seen, and in order.
+
+// Host time for KeyEvent::time: steady_clock, in ns
+inline int64_t inputClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The keypad after a change, bit per key
+struct KeyEvent {
+    int64_t time;            // inputClock() when the host saw it
+    uint16_t keys;
+};
+
+// Lock-free single-producer/single-consumer queue of key events. The
+// emulation thread drains it every frame, so it only ever holds a frame's
+// worth; a full queue drops the event rather than wait.
+class KeyQueue {
+public:
+    // Producer: false if there was no room
+    bool push(const KeyEvent& event) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == CAPACITY) return false;
+        events[h & (CAPACITY - 1)] = event;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: the oldest event without taking it, false if there's none
+    bool peek(KeyEvent& event) const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        event = events[t & (CAPACITY - 1)];
+        return true;
+    }
+
+    // Consumer: drop the event peek returned
+    void pop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static const size_t CAPACITY = 256;
+
+    KeyEvent events[CAPACITY] = {};
+    std::atomic<size_t> head{0};   // written by the producer
+    std::atomic<size_t> tail{0};   // written by the consumer
+};
+
+#endif // INPUT_H
@@ -0,0 +1,809 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t CODE_BUFFER_SIZE = 4 << 20;
+const int MAX_BLOCK_LENGTH = 64;  // instructions
+// Most code one instruction can turn into, FX65 being the longest, plus its
+// budget check and exit stub
+const size_t MAX_INSTRUCTION_CODE = 400;
+const size_t MAX_BLOCK_CODE = MAX_BLOCK_LENGTH * MAX_INSTRUCTION_CODE;
+// Invalidations after which a block is left to the interpreter, rather than
+// recompiled every time the code rewrites itself
+const uint8_t MAX_REWRITES = 8;
+// Most blocks compiled at once, and the code space they get, see installBlocks
+const size_t MAX_WINDOW_BLOCKS = 32;
+const size_t WINDOW_CODE = 8 * MAX_BLOCK_CODE;
+
+struct Block {
+    const uint8_t* entry;
+    uint16_t start;
+    uint16_t end;       // one past the last byte of the last instruction
+    uint32_t length;    // instructions
+    // Operands for the handlers the block calls; the code points into this
+    std::unique_ptr<DecodedOp[]> ops;
+};
+
+// A direct jump from one block to another's entry. While the target isn't
+// compiled it goes to a stub that looks the pc up in Jit::entries instead.
+struct Link {
+    uint8_t* site;      // the jump's rel32
+    uint8_t* stub;
+    uint16_t from;      // block the jump is in
+    uint16_t target;
+    bool linked;        // going to the target rather than the stub
+};
+
+// Point the rel32 at `site` at `to`
+void setJump(uint8_t* site, const uint8_t* to) {
+    int32_t rel = (int32_t)(to - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+} // namespace
+
+struct Jit {
+    uint8_t* code = nullptr;
+    size_t used = 0;
+    size_t shared = 0;                     // bytes of stubs at the start of `code` that every block uses
+    std::unique_ptr<Block> blocks[4096];   // by start address
+    const uint8_t* entries[4096] = {};     // blocks[pc]'s code, looked up by the generated code
+    uint8_t covered[4096] = {};            // number of blocks containing each byte
+    uint8_t rewrites[4096] = {};           // times the block at each address was invalidated, up to MAX_REWRITES
+    std::vector<Link> links;
+    // Invalidated blocks, kept alive until the run that triggered the store returns
+    std::vector<std::unique_ptr<Block>> retired;
+
+    // Shared stubs, see emitShared
+    uint64_t (*enter)(Chip8* chip, uint64_t count, const uint8_t* entry) = nullptr;
+    const uint8_t* dispatch = nullptr;
+    const uint8_t* idleCheck = nullptr;
+    const uint8_t* idle = nullptr;
+    const uint8_t* exit = nullptr;
+};
+
+#if CHIP8_JIT_X64
+
+namespace {
+
+// Minimal x86-64 emitter. While compiled code runs, the chip pointer lives
+// in rbx, the instructions left in the run in r12 and chip.instructionCount
+// + r12 (the count the run ends on) in r13.
+struct Emitter {
+    uint8_t* p;
+
+    void byte(uint8_t b) { *p++ = b; }
+    void u16(uint16_t v) { memcpy(p, &v, 2); p += 2; }
+    void u32(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+    void u64(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+    // <op> [rbx + disp32] with a ModRM of mod=10, rm=rbx
+    void rbxMem(uint8_t opcode, uint8_t reg, uint32_t disp) {
+        byte(opcode);
+        byte(0x83 | (reg << 3));
+        u32(disp);
+    }
+
+    // jmp/jcc rel32 to be filled in later; returns where the rel32 is
+    uint8_t* jump() {
+        byte(0xE9);
+        p += 4;
+        return p - 4;
+    }
+    uint8_t* jumpIf(uint8_t jcc) {
+        byte(0x0F); byte(jcc);
+        p += 4;
+        return p - 4;
+    }
+    void jumpTo(const uint8_t* to) { setJump(jump(), to); }
+    void jumpIfTo(uint8_t jcc, const uint8_t* to) { setJump(jumpIf(jcc), to); }
+    // Short forward jcc, and its landing point
+    uint8_t* shortJumpIf(uint8_t jcc) {
+        byte(jcc - 0x10);
+        return p++;
+    }
+    void land(uint8_t* rel8) { *rel8 = (uint8_t)(p - (rel8 + 1)); }
+
+    // handler(chip, op, pc); the new pc is left in ax
+    void callHandler(OpHandler handler, const DecodedOp* op, uint16_t pc) {
+        byte(0x48); byte(0x89); byte(0xDF); // mov rdi, rbx
+        byte(0x48); byte(0xBE); u64((uint64_t)op);      // mov rsi, op
+        byte(0xBA); u32(pc);                            // mov edx, pc
+        call((const void*)handler);
+    }
+    void call(const void* fn) {
+        byte(0x48); byte(0xB8); u64((uint64_t)fn);      // mov rax, fn
+        byte(0xFF); byte(0xD0);                         // call rax
+    }
+    void movEax(uint32_t v) { byte(0xB8); u32(v); }
+    // One instruction done: dec r12
+    void countDown() { byte(0x49); byte(0xFF); byte(0xCC); }
+};
+
+const uint32_t OFF_V = offsetof(Chip8, V);
+const uint32_t OFF_VF = offsetof(Chip8, V) + 0xF;
+const uint32_t OFF_I = offsetof(Chip8, I);
+const uint32_t OFF_PC = offsetof(Chip8, pc);
+const uint32_t OFF_MEMORY = offsetof(Chip8, memory);
+const uint32_t OFF_DELAY = offsetof(Chip8, delay_timer);
+const uint32_t OFF_STACK = offsetof(Chip8, stack);
+const uint32_t OFF_SP = offsetof(Chip8, sp);
+const uint32_t OFF_KEYPAD = offsetof(Chip8, keypad);
+const uint32_t OFF_COUNT = offsetof(Chip8, instructionCount);
+const uint32_t OFF_IDLE_SKIP = offsetof(Chip8, idleSkip);
+const uint32_t OFF_IDLE_BACKOFF = offsetof(Chip8, idleBackoff);
+
+const uint8_t JB = 0x82;
+const uint8_t JE = 0x84;
+const uint8_t JNE = 0x85;
+const uint8_t JBE = 0x86;
+const uint8_t JA = 0x87;
+const uint8_t SETAE = 0x93;
+const uint8_t SETA = 0x97;
+
+// chip.instructionCount = r13 - r12, exact before an instruction that hasn't counted down yet
+void emitSyncCount(Emitter& e) {
+    e.byte(0x4C); e.byte(0x89); e.byte(0xE8);          // mov rax, r13
+    e.byte(0x4C); e.byte(0x29); e.byte(0xE0);          // sub rax, r12
+    e.byte(0x48); e.rbxMem(0x89, 0, OFF_COUNT);        // mov [count], rax
+}
+
+// The stubs every block jumps to, at the start of the code buffer:
+//   enter(chip, count, entry) runs compiled code from `entry` for `count`
+//     instructions and returns how many are left
+//   exit: stop with ax as the pc
+//   dispatch: carry on at ax, through Jit::entries, or stop there
+//   idleCheck: dispatch, after the check a backward jump gets, see skipIdleLoop
+//   idle: skipIdleLoop at ax, then dispatch
+void emitShared(Jit& jit) {
+    Emitter e{ jit.code };
+
+    jit.enter = (uint64_t (*)(Chip8*, uint64_t, const uint8_t*))e.p;
+    e.byte(0x53);                                      // push rbx
+    e.byte(0x41); e.byte(0x54);                        // push r12
+    e.byte(0x41); e.byte(0x55);                        // push r13 (leaves the stack aligned for calls)
+    e.byte(0x48); e.byte(0x89); e.byte(0xFB);          // mov rbx, rdi
+    e.byte(0x49); e.byte(0x89); e.byte(0xF4);          // mov r12, rsi
+    e.byte(0x4C); e.rbxMem(0x8B, 5, OFF_COUNT);        // mov r13, [count]
+    e.byte(0x49); e.byte(0x01); e.byte(0xF5);          // add r13, rsi
+    e.byte(0xFF); e.byte(0xE2);                        // jmp rdx
+
+    jit.exit = e.p;
+    e.byte(0x66); e.rbxMem(0x89, 0, OFF_PC);           // mov [pc], ax
+    emitSyncCount(e);
+    e.byte(0x4C); e.byte(0x89); e.byte(0xE0);          // mov rax, r12
+    e.byte(0x41); e.byte(0x5D);                        // pop r13
+    e.byte(0x41); e.byte(0x5C);                        // pop r12
+    e.byte(0x5B);                                      // pop rbx
+    e.byte(0xC3);                                      // ret
+
+    jit.dispatch = e.p;
+    e.byte(0x0F); e.byte(0xB7); e.byte(0xC0);          // movzx eax, ax
+    e.byte(0x3D); e.u32(0xFFE);                        // cmp eax, 0xFFE
+    e.jumpIfTo(JA, jit.exit);                          // the interpreter deals with pc running off the end
+    e.byte(0x48); e.byte(0xB9); e.u64((uint64_t)jit.entries); // mov rcx, entries
+    e.byte(0x48); e.byte(0x8B); e.byte(0x0C); e.byte(0xC1);   // mov rcx, [rcx + rax * 8]
+    e.byte(0x48); e.byte(0x85); e.byte(0xC9);          // test rcx, rcx
+    e.jumpIfTo(JE, jit.exit);                          // not compiled
+    e.byte(0xFF); e.byte(0xE1);                        // jmp rcx
+
+    // Same test as the AOT code's: only runs of 32 or more can be idle
+    // (IDLE_MIN_RUN), and failed checks back off
+    jit.idleCheck = e.p;
+    e.byte(0x49); e.byte(0x83); e.byte(0xFC); e.byte(32); // cmp r12, 32
+    e.jumpIfTo(JB, jit.dispatch);
+    e.rbxMem(0x80, 7, OFF_IDLE_SKIP); e.byte(0);       // cmp byte [idleSkip], 0
+    e.jumpIfTo(JE, jit.dispatch);
+    e.byte(0x66); e.rbxMem(0x83, 7, OFF_IDLE_BACKOFF); e.byte(0); // cmp word [idleBackoff], 0
+    uint8_t* check = e.jumpIf(JE);
+    e.byte(0x66); e.rbxMem(0xFF, 1, OFF_IDLE_BACKOFF); // dec word [idleBackoff]
+    e.jumpTo(jit.dispatch);
+
+    jit.idle = e.p;
+    setJump(check, jit.idle);
+    e.byte(0x66); e.rbxMem(0x89, 0, OFF_PC);           // mov [pc], ax
+    emitSyncCount(e);
+    e.byte(0x48); e.byte(0x89); e.byte(0xDF);          // mov rdi, rbx
+    e.byte(0x4C); e.byte(0x89); e.byte(0xE6);          // mov rsi, r12
+    e.call((const void*)skipIdleLoop);
+    e.byte(0x49); e.byte(0x29); e.byte(0xC4);          // sub r12, rax
+    e.byte(0x0F); e.rbxMem(0xB7, 0, OFF_PC);           // movzx eax, word [pc]
+    e.jumpTo(jit.dispatch);
+
+    jit.shared = e.p - jit.code;
+    jit.used = jit.shared;
+}
+
+// The quirks that change what gets emitted
+struct EmitQuirks {
+    bool vfReset;
+    bool shiftVy;
+    bool memoryIncrement;
+    bool displayWait;
+};
+
+EmitQuirks emitQuirks(QuirkProfile profile) {
+    return withQuirks(profile, [](auto q) {
+        using Q = decltype(q);
+        return EmitQuirks{ Q::vfReset, Q::shiftVy, Q::memoryIncrement, Q::displayWait };
+    });
+}
+
+// Opcodes simple enough to emit inline. Each does what its handler does, in
+// the same order, so VF aliasing VX or VY comes out the same.
+void emitNative(Emitter& e, const DecodedOp& op, const EmitQuirks& quirks) {
+    const uint32_t vx = OFF_V + op.x;
+    const uint32_t vy = OFF_V + op.y;
+    switch (op.opcode & 0xF000) {
+        case 0x6000: // mov byte [V + x], nn
+            e.rbxMem(0xC6, 0, vx); e.byte(op.nn);
+            return;
+        case 0x7000: // add byte [V + x], nn
+            e.rbxMem(0x80, 0, vx); e.byte(op.nn);
+            return;
+        case 0x8000: {
+            const uint32_t from = OFF_V + (quirks.shiftVy ? op.y : op.x);
+            switch (op.n) {
+                case 0x0:
+                case 0x1:
+                case 0x2:
+                case 0x3: {
+                    static const uint8_t aluOps[4] = { 0x88, 0x08, 0x20, 0x30 }; // mov, or, and, xor
+                    e.rbxMem(0x8A, 0, vy);                 // mov al, [Vy]
+                    e.rbxMem(aluOps[op.n], 0, vx);         // <op> [Vx], al
+                    if (op.n != 0 && quirks.vfReset) {
+                        e.rbxMem(0xC6, 0, OFF_VF); e.byte(0); // mov byte [VF], 0
+                    }
+                    return;
+                }
+                case 0x4:
+                    e.rbxMem(0x8A, 0, vx);                 // mov al, [Vx]
+                    e.rbxMem(0x02, 0, vy);                 // add al, [Vy]
+                    e.rbxMem(0x88, 0, vx);                 // mov [Vx], al
+                    e.rbxMem(0x8A, 1, vy);                 // mov cl, [Vy]
+                    e.rbxMem(0x3A, 1, vx);                 // cmp cl, [Vx]
+                    e.byte(0x0F); e.byte(SETA); e.byte(0xC1); // seta cl
+                    e.rbxMem(0x88, 1, OFF_VF);             // mov [VF], cl
+                    return;
+                case 0x5:
+                case 0x7: {
+                    // 8XY5: VF = VX >= VY, VX = VX - VY; 8XY7: VF = VY > VX, VX = VY - VX
+                    const uint32_t a = op.n == 0x5 ? vx : vy;
+                    const uint32_t b = op.n == 0x5 ? vy : vx;
+                    e.rbxMem(0x8A, 0, a);                  // mov al, [a]
+                    e.rbxMem(0x3A, 0, b);                  // cmp al, [b]
+                    e.byte(0x0F); e.byte(op.n == 0x5 ? SETAE : SETA); e.byte(0xC1); // setae/seta cl
+                    e.rbxMem(0x88, 1, OFF_VF);             // mov [VF], cl
+                    e.rbxMem(0x8A, 0, a);                  // mov al, [a]
+                    e.rbxMem(0x2A, 0, b);                  // sub al, [b]
+                    e.rbxMem(0x88, 0, vx);                 // mov [Vx], al
+                    return;
+                }
+                case 0x6:
+                    e.rbxMem(0x8A, 0, from);               // mov al, [from]
+                    e.byte(0x24); e.byte(0x01);            // and al, 1
+                    e.rbxMem(0x88, 0, OFF_VF);             // mov [VF], al
+                    e.rbxMem(0x8A, 0, from);               // mov al, [from]
+                    e.byte(0xD0); e.byte(0xE8);            // shr al, 1
+                    e.rbxMem(0x88, 0, vx);                 // mov [Vx], al
+                    return;
+                case 0xE:
+                    e.rbxMem(0x8A, 0, from);               // mov al, [from]
+                    e.byte(0xC0); e.byte(0xE8); e.byte(7); // shr al, 7
+                    e.rbxMem(0x88, 0, OFF_VF);             // mov [VF], al
+                    e.rbxMem(0x8A, 0, from);               // mov al, [from]
+                    e.byte(0x00); e.byte(0xC0);            // add al, al
+                    e.rbxMem(0x88, 0, vx);                 // mov [Vx], al
+                    return;
+            }
+            return;
+        }
+        case 0xA000: // mov word [I], nnn
+            e.byte(0x66); e.rbxMem(0xC7, 0, OFF_I); e.u16(op.nnn);
+            return;
+        case 0xF000:
+            switch (op.nn) {
+                case 0x07:
+                    e.rbxMem(0x8A, 0, OFF_DELAY);          // mov al, [delay_timer]
+                    e.rbxMem(0x88, 0, vx);                 // mov [Vx], al
+                    return;
+                case 0x15:
+                    e.rbxMem(0x8A, 0, vx);                 // mov al, [Vx]
+                    e.rbxMem(0x88, 0, OFF_DELAY);          // mov [delay_timer], al
+                    return;
+                case 0x1E:
+                    e.byte(0x0F); e.rbxMem(0xB6, 0, vx);   // movzx eax, byte [Vx]
+                    e.byte(0x0F); e.rbxMem(0xB7, 1, OFF_I); // movzx ecx, word [I]
+                    e.byte(0x01); e.byte(0xC8);            // add eax, ecx
+                    e.byte(0x3D); e.u32(0xFFF);            // cmp eax, 0xFFF
+                    e.byte(0x0F); e.byte(SETA); e.byte(0xC1); // seta cl
+                    e.rbxMem(0x88, 1, OFF_VF);             // mov [VF], cl
+                    e.byte(0x25); e.u32(0xFFF);            // and eax, 0xFFF
+                    e.byte(0x66); e.rbxMem(0x89, 0, OFF_I); // mov [I], ax
+                    return;
+                case 0x29:
+                case 0x30:
+                    e.byte(0x0F); e.rbxMem(0xB6, 0, vx);   // movzx eax, byte [Vx]
+                    if (op.nn == 0x30) {
+                        e.byte(0x83); e.byte(0xE0); e.byte(0x0F); // and eax, 0xF
+                    }
+                    e.byte(0x8D); e.byte(0x04); e.byte(0x80);     // lea eax, [rax + rax * 4]
+                    if (op.nn == 0x30) {
+                        e.byte(0x01); e.byte(0xC0);               // add eax, eax
+                        e.byte(0x05); e.u32(BIG_FONT_ADDRESS);    // add eax, BIG_FONT_ADDRESS
+                    }
+                    e.byte(0x66); e.rbxMem(0x89, 0, OFF_I); // mov [I], ax
+                    return;
+                case 0x65:
+                    e.byte(0x0F); e.rbxMem(0xB7, 0, OFF_I); // movzx eax, word [I]
+                    for (int i = 0; i <= op.x; ++i) {
+                        e.byte(0x8D); e.byte(0x48); e.byte((uint8_t)i); // lea ecx, [rax + i]
+                        e.byte(0x81); e.byte(0xE1); e.u32(0xFFF);       // and ecx, 0xFFF
+                        e.byte(0x8A); e.byte(0x94); e.byte(0x0B); e.u32(OFF_MEMORY); // mov dl, [rbx + rcx + memory]
+                        e.rbxMem(0x88, 2, OFF_V + i);                   // mov [V + i], dl
+                    }
+                    if (quirks.memoryIncrement) {
+                        e.byte(0x8D); e.byte(0x48); e.byte((uint8_t)(op.x + 1)); // lea ecx, [rax + x + 1]
+                        e.byte(0x81); e.byte(0xE1); e.u32(0xFFF);       // and ecx, 0xFFF
+                        e.byte(0x66); e.rbxMem(0x89, 1, OFF_I);         // mov [I], cx
+                    }
+                    return;
+            }
+            return;
+    }
+}
+
+// Native: emitted inline. Call: calls its handler and carries on. Timed: the
+// same, but the handler reads chip.instructionCount, so that's brought up to
+// date first. Store: calls its handler, which might rewrite the code that
+// follows, so the block ends. Branch: ends the block with a jump computed
+// inline. Terminator: ends the block with its handler's pc.
+enum class OpKind { Native, Call, Timed, Store, Branch, Terminator };
+
+OpKind classify(const DecodedOp& op, const EmitQuirks& quirks) {
+    switch (op.opcode & 0xF000) {
+        case 0x0000:
+            // Same tests in the same order as decodeOpcode
+            if (op.nn == 0xE0) return OpKind::Call;
+            if (op.nn == 0xEE) return OpKind::Branch;
+            if (op.x == 0 && (op.y == 0xC || op.y == 0xD)) return OpKind::Call;
+            if (op.nn == 0xFB || op.nn == 0xFC || op.nn == 0xFE || op.nn == 0xFF) return OpKind::Call;
+            return OpKind::Terminator;
+        case 0x1000: case 0x2000: case 0x3000: case 0x4000: case 0xE000:
+            return OpKind::Branch;
+        case 0x5000: case 0x9000:
+            return op.n == 0 ? OpKind::Branch : OpKind::Terminator;
+        case 0x6000: case 0x7000: case 0xA000:
+            return OpKind::Native;
+        case 0x8000:
+            if (op.n <= 0x7 || op.n == 0xE) return OpKind::Native;
+            return OpKind::Terminator;
+        case 0xC000:
+            return OpKind::Call;
+        case 0xD000:
+            // The VIP's stays put until the next tick
+            return quirks.displayWait ? OpKind::Terminator : OpKind::Call;
+        case 0xF000:
+            switch (op.nn) {
+                case 0x07: case 0x15: case 0x1E: case 0x29: case 0x30: case 0x65:
+                    return OpKind::Native;
+                case 0x18:
+                    return OpKind::Timed;
+                case 0x75: case 0x80: case 0x85:
+                    return OpKind::Call;
+                case 0x33: case 0x55:
+                    return OpKind::Store;
+            }
+            return OpKind::Terminator;
+    }
+    // BNNN and anything unknown
+    return OpKind::Terminator;
+}
+
+// A jump out of the block being compiled, pointed at its stub once the body is done
+struct Exit {
+    uint8_t* site;
+    uint16_t pc;
+    const uint8_t* to;  // where the stub goes with the pc in ax
+    bool link;          // a jump to the block at `pc`, see Link
+};
+
+struct BlockEmitter {
+    Jit& jit;
+    Emitter e;
+    std::vector<Exit> exits;
+
+    // Jump to the block at `pc`, directly once it's compiled
+    void linkTo(uint8_t* site, uint16_t pc) {
+        // The interpreter deals with pc running off the end
+        if (pc > 0xFFE) exits.push_back({ site, pc, jit.exit, false });
+        else exits.push_back({ site, pc, jit.dispatch, true });
+    }
+    void jumpToBlock(uint16_t pc) { linkTo(e.jump(), pc); }
+    // Skip: the block at pc + 4 if `jcc`, pc + 2 otherwise
+    void skipIf(uint8_t jcc, uint16_t pc) {
+        linkTo(e.jumpIf(jcc), pc + 4);
+        jumpToBlock(pc + 2);
+    }
+};
+
+// Jumps, calls, returns and skips; the instruction has already counted down
+void emitBranch(BlockEmitter& b, const DecodedOp& op, uint16_t pc) {
+    Emitter& e = b.e;
+    switch (op.opcode & 0xF000) {
+        case 0x0000: // 00EE
+            e.byte(0x66); e.rbxMem(0xFF, 1, OFF_SP);           // dec word [sp]
+            e.byte(0x0F); e.rbxMem(0xB7, 0, OFF_SP);           // movzx eax, word [sp]
+            e.byte(0x83); e.byte(0xE0); e.byte(0x0F);          // and eax, 0xF
+            e.byte(0x0F); e.byte(0xB7); e.byte(0x84); e.byte(0x43); e.u32(OFF_STACK); // movzx eax, word [rbx + rax * 2 + stack]
+            e.byte(0x83); e.byte(0xC0); e.byte(0x02);          // add eax, 2
+            e.jumpTo(b.jit.dispatch);
+            return;
+        case 0x1000:
+            if (op.nnn <= pc) {
+                // A backward jump may close an idle loop: the same check as
+                // idleCheck, but going on to the target directly
+                e.byte(0x49); e.byte(0x83); e.byte(0xFC); e.byte(32); // cmp r12, 32
+                uint8_t* shortRun = e.shortJumpIf(JB);
+                e.rbxMem(0x80, 7, OFF_IDLE_SKIP); e.byte(0);   // cmp byte [idleSkip], 0
+                uint8_t* off = e.shortJumpIf(JE);
+                e.byte(0x66); e.rbxMem(0x83, 7, OFF_IDLE_BACKOFF); e.byte(0); // cmp word [idleBackoff], 0
+                b.exits.push_back({ e.jumpIf(JE), op.nnn, b.jit.idle, false });
+                e.byte(0x66); e.rbxMem(0xFF, 1, OFF_IDLE_BACKOFF); // dec word [idleBackoff]
+                e.land(shortRun);
+                e.land(off);
+            }
+            b.jumpToBlock(op.nnn);
+            return;
+        case 0x2000:
+            e.byte(0x0F); e.rbxMem(0xB7, 0, OFF_SP);           // movzx eax, word [sp]
+            e.byte(0x83); e.byte(0xE0); e.byte(0x0F);          // and eax, 0xF
+            e.byte(0x66); e.byte(0xC7); e.byte(0x84); e.byte(0x43); e.u32(OFF_STACK); e.u16(pc); // mov word [rbx + rax * 2 + stack], pc
+            e.byte(0x66); e.rbxMem(0xFF, 0, OFF_SP);           // inc word [sp]
+            b.jumpToBlock(op.nnn);
+            return;
+        case 0x3000: // cmp byte [V + x], nn
+        case 0x4000:
+            e.rbxMem(0x80, 7, OFF_V + op.x); e.byte(op.nn);
+            b.skipIf((op.opcode & 0xF000) == 0x3000 ? JE : JNE, pc);
+            return;
+        case 0x5000:
+        case 0x9000:
+            e.rbxMem(0x8A, 0, OFF_V + op.y);                   // mov al, [V + y]
+            e.rbxMem(0x38, 0, OFF_V + op.x);                   // cmp [V + x], al
+            b.skipIf((op.opcode & 0xF000) == 0x5000 ? JE : JNE, pc);
+            return;
+        case 0xE000: {
+            // Pressed: VX < 16 and keypad[VX] == 1
+            e.byte(0x0F); e.rbxMem(0xB6, 0, OFF_V + op.x);     // movzx eax, byte [V + x]
+            e.byte(0xB1); e.byte(0);                           // mov cl, 0
+            e.byte(0x83); e.byte(0xF8); e.byte(16);            // cmp eax, 16
+            uint8_t* outOfRange = e.shortJumpIf(0x83);         // jae
+            e.byte(0x8A); e.byte(0x8C); e.byte(0x03); e.u32(OFF_KEYPAD); // mov cl, [rbx + rax + keypad]
+            e.land(outOfRange);
+            e.byte(0x80); e.byte(0xF9); e.byte(1);             // cmp cl, 1
+            // Decoded as EXA1 for A1 and EX9E for anything else
+            b.skipIf(op.nn == 0xA1 ? JNE : JE, pc);
+            return;
+        }
+    }
+}
+
+// Compile the block at `start` to jit.code + jit.used, which has room for
+// MAX_BLOCK_CODE bytes and is writable
+std::unique_ptr<Block> compileBlock(Jit& jit, const Chip8& chip, uint16_t start) {
+    auto block = std::make_unique<Block>();
+    block->ops.reset(new DecodedOp[MAX_BLOCK_LENGTH]);
+    block->start = start;
+
+    // Decode up to the instruction that ends the block
+    const EmitQuirks quirks = emitQuirks(chip.quirks);
+    uint16_t pc = start;
+    uint32_t length = 0;
+    bool ended = false;
+    while (!ended && length < MAX_BLOCK_LENGTH && pc + 1 <= 0xFFF) {
+        DecodedOp& op = block->ops[length++];
+        op = decodeOpcode(chip.memory[pc] << 8 | chip.memory[pc + 1], chip.quirks);
+        OpKind kind = classify(op, quirks);
+        ended = kind == OpKind::Store || kind == OpKind::Branch || kind == OpKind::Terminator;
+        pc += 2;
+    }
+
+    BlockEmitter b{ jit, Emitter{ jit.code + jit.used }, {} };
+    Emitter& e = b.e;
+    block->entry = e.p;
+    // Every instruction runs only with some of the run left: r12 is checked
+    // on the way in and counted down after each one
+    e.byte(0x4D); e.byte(0x85); e.byte(0xE4);                  // test r12, r12
+    b.exits.push_back({ e.jumpIf(JE), start, jit.exit, false });
+
+    pc = start;
+    for (uint32_t k = 0; k < length; ++k, pc += 2) {
+        const DecodedOp& op = block->ops[k];
+        const bool last = k + 1 == length;
+        switch (classify(op, quirks)) {
+            case OpKind::Native:
+                emitNative(e, op, quirks);
+                break;
+            case OpKind::Timed:
+                emitSyncCount(e);
+                e.callHandler(op.handler, &op, pc);
+                break;
+            case OpKind::Call:
+                e.callHandler(op.handler, &op, pc);
+                break;
+            case OpKind::Store:
+                // Whatever follows may have been rewritten, so go through entries
+                e.callHandler(op.handler, &op, pc);
+                e.countDown();
+                e.jumpTo(jit.dispatch);
+                continue;
+            case OpKind::Branch:
+                e.countDown();
+                emitBranch(b, op, pc);
+                continue;
+            case OpKind::Terminator:
+                e.callHandler(op.handler, &op, pc);
+                e.countDown();
+                if ((op.opcode & 0xF0FF) == 0xF00A) {
+                    // Waiting for a key: jitRunCycles parks on it
+                    e.jumpTo(jit.exit);
+                } else {
+                    // Staying put (00FD, the VIP's DXYN) or going back may be an idle loop
+                    e.byte(0x0F); e.byte(0xB7); e.byte(0xC0);  // movzx eax, ax
+                    e.byte(0x3D); e.u32(pc);                   // cmp eax, pc
+                    e.jumpIfTo(JBE, jit.idleCheck);
+                    e.jumpTo(jit.dispatch);
+                }
+                continue;
+        }
+        e.countDown();
+        if (last) {
+            // Ran out of block length or memory: carry on with the next one
+            b.jumpToBlock(pc + 2);
+        } else {
+            b.exits.push_back({ e.jumpIf(JE), (uint16_t)(pc + 2), jit.exit, false });
+        }
+    }
+
+    // Stubs for the jumps out: mov eax, pc; jmp to
+    for (const Exit& exit : b.exits) {
+        uint8_t* stub = e.p;
+        setJump(exit.site, stub);
+        e.movEax(exit.pc);
+        e.jumpTo(exit.to);
+        if (exit.link) jit.links.push_back({ exit.site, stub, start, exit.pc, false });
+    }
+
+    block->end = pc;
+    block->length = length;
+    jit.used = e.p - jit.code;
+    return block;
+}
+
+} // namespace
+
+// Code is written while compiling and executable while running, never
+// both. Each change to it opens one window over just the pages it writes:
+// mprotect costs more the more pages it covers, and each call costs plenty.
+struct WriteWindow {
+    uintptr_t first = UINTPTR_MAX;
+    uintptr_t last = 0;
+
+    void cover(const uint8_t* from, const uint8_t* to) {
+        static const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        first = std::min(first, (uintptr_t)from & ~(page - 1));
+        last = std::max(last, ((uintptr_t)to + page - 1) & ~(page - 1));
+    }
+    void protect(int prot) const {
+        if (first < last) mprotect((void*)first, last - first, prot);
+    }
+    void open() const { protect(PROT_READ | PROT_WRITE); }
+    void close() const { protect(PROT_READ | PROT_EXEC); }
+};
+
+Jit* createJit() {
+    Jit* jit = new Jit();
+    // Written while compiling, executable while running, never both
+    void* mem = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit->code = mem == MAP_FAILED ? nullptr : (uint8_t*)mem;
+    if (jit->code) {
+        emitShared(*jit);
+        WriteWindow window;
+        window.cover(jit->code, jit->code + jit->shared);
+        window.close();
+    }
+    return jit;
+}
+
+void destroyJit(Jit* jit) {
+    if (!jit) return;
+    if (jit->code) munmap(jit->code, CODE_BUFFER_SIZE);
+    delete jit;
+}
+
+#else
+
+struct WriteWindow {
+    void cover(const uint8_t*, const uint8_t*) {}
+    void open() const {}
+    void close() const {}
+};
+
+Jit* createJit() {
+    return new Jit();
+}
+
+void destroyJit(Jit* jit) {
+    delete jit;
+}
+
+#endif
+
+static void removeBlock(Jit& jit, uint16_t start) {
+    std::unique_ptr<Block>& block = jit.blocks[start];
+    if (!block) return;
+    for (uint16_t a = block->start; a < block->end; ++a) {
+        jit.covered[a]--;
+    }
+    jit.entries[start] = nullptr;
+    if (jit.rewrites[start] < MAX_REWRITES) jit.rewrites[start]++;
+    // Jumps into it go back to their stubs; its own jumps go with it
+    WriteWindow window;
+    for (const Link& link : jit.links) {
+        if (link.target == start && link.from != start) window.cover(link.site, link.site + 4);
+    }
+    window.open();
+    for (size_t i = 0; i < jit.links.size();) {
+        Link& link = jit.links[i];
+        if (link.target == start && link.from != start) {
+            setJump(link.site, link.stub);
+            link.linked = false;
+        }
+        if (link.from == start) {
+            link = jit.links.back();
+            jit.links.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    window.close();
+    // A block can invalidate itself with a store, so keep its operands alive
+    // until the run returns. The code bytes are only reclaimed by jitFlush.
+    jit.retired.push_back(std::move(block));
+}
+
+void jitInvalidate(Jit& jit, uint16_t addr) {
+    addr &= 0xFFF;
+    if (!jit.covered[addr]) return;
+    // A block covering addr starts at most MAX_BLOCK_LENGTH instructions before it
+    int first = addr - MAX_BLOCK_LENGTH * 2;
+    for (int start = first < 0 ? 0 : first; start <= addr; ++start) {
+        const std::unique_ptr<Block>& block = jit.blocks[start];
+        if (block && block->end > addr) removeBlock(jit, start);
+    }
+}
+
+void jitFlush(Jit& jit) {
+    for (int start = 0; start < 4096; ++start) {
+        jit.blocks[start].reset();
+    }
+    memset(jit.entries, 0, sizeof(jit.entries));
+    memset(jit.covered, 0, sizeof(jit.covered));
+    memset(jit.rewrites, 0, sizeof(jit.rewrites));
+    jit.links.clear();
+    jit.retired.clear();
+    jit.used = jit.shared;
+}
+
+void attachJit(Chip8& chip, Jit* jit) {
+    chip.jit = jit;
+    if (jit) jitFlush(*jit);
+}
+
+void detachJit(Chip8& chip) {
+    chip.jit = nullptr;
+}
+
+#if CHIP8_JIT_X64
+// Compile the block at chip.pc, and the blocks its jumps go to that aren't
+// compiled yet, following the control flow like chip8_aotc does: each write
+// window costs a couple of system calls, so it's worth filling.
+static Block* installBlocks(Jit& jit, const Chip8& chip) {
+    // Out of code space, start over
+    if (jit.used + WINDOW_CODE > CODE_BUFFER_SIZE) jitFlush(jit);
+    const size_t limit = jit.used + WINDOW_CODE;
+    const size_t firstLink = jit.links.size();
+    WriteWindow window;
+    window.cover(jit.code + jit.used, jit.code + limit);
+    window.open();
+    std::vector<uint16_t> queue = { chip.pc };
+    for (size_t i = 0; i < queue.size() && i < MAX_WINDOW_BLOCKS && jit.used + MAX_BLOCK_CODE <= limit; ++i) {
+        const uint16_t pc = queue[i];
+        if (jit.blocks[pc]) continue;
+        const size_t links = jit.links.size();
+        std::unique_ptr<Block> compiled = compileBlock(jit, chip, pc);
+        for (uint16_t a = compiled->start; a < compiled->end; ++a) {
+            jit.covered[a]++;
+        }
+        jit.entries[pc] = compiled->entry;
+        jit.blocks[pc] = std::move(compiled);
+        for (size_t l = links; l < jit.links.size(); ++l) {
+            const uint16_t target = jit.links[l].target;
+            if (!jit.blocks[target] && jit.rewrites[target] < MAX_REWRITES) queue.push_back(target);
+        }
+    }
+    // The new blocks' jumps are in the window already
+    for (size_t l = firstLink; l < jit.links.size(); ++l) {
+        Link& link = jit.links[l];
+        if (jit.entries[link.target]) {
+            setJump(link.site, jit.entries[link.target]);
+            link.linked = true;
+        }
+    }
+    window.close();
+
+    // Then the older blocks' jumps to them
+    WriteWindow older;
+    for (const Link& link : jit.links) {
+        if (!link.linked && jit.entries[link.target]) older.cover(link.site, link.site + 4);
+    }
+    older.open();
+    for (Link& link : jit.links) {
+        if (!link.linked && jit.entries[link.target]) {
+            setJump(link.site, jit.entries[link.target]);
+            link.linked = true;
+        }
+    }
+    older.close();
+    return jit.blocks[chip.pc].get();
+}
+#endif
+
+void jitRunCycles(Chip8& chip, uint64_t count) {
+    Jit* jit = chip.jit;
+    // Compiled blocks can't be profiled instruction by instruction either
+    if (chip.profiler) jit = nullptr;
+#ifdef CHIP8_TRACE
+    // Compiled blocks can't be traced instruction by instruction
+    if (chip.trace) jit = nullptr;
+#endif
+#if CHIP8_JIT_X64
+    if (jit && jit->code) {
+        // Compiled code runs until the count is spent, it reaches code that
+        // isn't compiled yet, or an FX0A waits
+        while (count > 0) {
+            if (chip.keyWait) {
+                count -= skipIdleLoop(chip, count);
+                continue;
+            }
+            if (chip.pc > 0xFFE || jit->rewrites[chip.pc] == MAX_REWRITES) {
+                // Let the interpreter deal with pc running off the end of memory, and code that keeps changing
+                runCycles(chip, 1);
+                count--;
+                continue;
+            }
+            Block* block = jit->blocks[chip.pc].get();
+            if (!block) block = installBlocks(*jit, chip);
+            count = jit->enter(&chip, count, block->entry);
+            if (!jit->retired.empty()) jit->retired.clear();
+        }
+    }
+#endif
+    runCycles(chip, count);
+}
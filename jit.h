@@ -0,0 +1,39 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+
+struct Chip8;
+
+// Optional basic-block recompiler for x86-64.
+//
+// Straight-line runs of opcodes are translated to host code and cached by
+// start address. A block ends at the first jump/call/return/skip (or after
+// a store, which might rewrite the code that follows it). Draws only end a
+// block under the VIP profile, where DXYN waits for the next tick; otherwise
+// the block carries on past them. Blocks jump straight to each other (both
+// sides of a skip, 1NNN), and only return to jitRunCycles when the count
+// runs out or pc leaves compiled code; the idle loop check runs on backward
+// jumps only. All register state stays in the Chip8 struct, so emulateCycle
+// can take over at any instruction boundary. Code memory is writable or
+// executable, never both. On other architectures nothing is compiled and
+// jitRunCycles simply interprets.
+struct Jit;
+
+Jit* createJit();
+void destroyJit(Jit* jit);
+
+// Attach/detach the recompiler; memory writes through writeMemory are
+// forwarded to it while attached
+void attachJit(Chip8& chip, Jit* jit);
+void detachJit(Chip8& chip);
+
+// Execute exactly `count` instructions, same result as runCycles
+void jitRunCycles(Chip8& chip, uint64_t count);
+
+// Drop any block that covers `addr`
+void jitInvalidate(Jit& jit, uint16_t addr);
+// Drop every block
+void jitFlush(Jit& jit);
+
+#endif // JIT_H
@@ -0,0 +1,188 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const char* const CLASS_NAMES[OP_CLASS_COUNT] = {
+    "00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE", "00FF", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30", "FX33", "FX55", "FX65",
+    "FX75", "FX85",
+    "unknown"
+};
+
+// Same split as decodeOpcode
+OpcodeClass opcodeClass(uint16_t opcode) {
+    uint8_t n = opcode & 0xF, nn = opcode & 0xFF;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (nn == 0xE0) return OP_00E0;
+            if (nn == 0xEE) return OP_00EE;
+            if ((opcode & 0x0FF0) == 0x00C0) return OP_00CN;
+            if ((opcode & 0x0FF0) == 0x00D0) return OP_00DN;
+            if (nn >= 0xFB) return (OpcodeClass)(OP_00FB + (nn - 0xFB));
+            return OP_0NNN;
+        case 0x1000: return OP_1NNN;
+        case 0x2000: return OP_2NNN;
+        case 0x3000: return OP_3XNN;
+        case 0x4000: return OP_4XNN;
+        case 0x5000: return n == 0 ? OP_5XY0 : OP_UNKNOWN;
+        case 0x6000: return OP_6XNN;
+        case 0x7000: return OP_7XNN;
+        case 0x8000:
+            if (n <= 0x7) return (OpcodeClass)(OP_8XY0 + n);
+            return n == 0xE ? OP_8XYE : OP_UNKNOWN;
+        case 0x9000: return n == 0 ? OP_9XY0 : OP_UNKNOWN;
+        case 0xA000: return OP_ANNN;
+        case 0xB000: return OP_BNNN;
+        case 0xC000: return OP_CXNN;
+        case 0xD000: return OP_DXYN;
+        case 0xE000: return nn == 0xA1 ? OP_EXA1 : OP_EX9E;
+        default:
+            switch (nn) {
+                case 0x07: return OP_FX07;
+                case 0x0A: return OP_FX0A;
+                case 0x15: return OP_FX15;
+                case 0x18: return OP_FX18;
+                case 0x1E: return OP_FX1E;
+                case 0x29: return OP_FX29;
+                case 0x30: return OP_FX30;
+                case 0x33: return OP_FX33;
+                case 0x55: return OP_FX55;
+                case 0x65: return OP_FX65;
+                case 0x75: return OP_FX75;
+                case 0x85: return OP_FX85;
+                default: return OP_UNKNOWN;
+            }
+    }
+}
+
+const char* opcodeClassName(OpcodeClass cls) {
+    return cls < OP_CLASS_COUNT ? CLASS_NAMES[cls] : "?";
+}
+
+// One table lookup per instruction instead of running opcodeClass's switch
+static const uint8_t* buildClassTable() {
+    static uint8_t table[65536];
+    for (uint32_t opcode = 0; opcode < 65536; ++opcode) {
+        table[opcode] = opcodeClass((uint16_t)opcode);
+    }
+    return table;
+}
+
+Profiler::Profiler() {
+    static const uint8_t* table = buildClassTable();
+    classes = table;
+    reset();
+}
+
+uint64_t Profiler::instructions() const {
+    uint64_t total = 0;
+    for (uint64_t count : classCounts) total += count;
+    return total;
+}
+
+void Profiler::reset() {
+    memset(classCounts, 0, sizeof(classCounts));
+    memset(pcCounts, 0, sizeof(pcCounts));
+    memset(loopCounts, 0, sizeof(loopCounts));
+    memset(loopTails, 0, sizeof(loopTails));
+    emulate.reset();
+    input.reset();
+    draw.reset();
+    latency.reset();
+}
+
+// Addresses with a non-zero count, most executed first, at most `limit` of them
+static std::vector<uint16_t> hottest(const uint64_t* counts, size_t limit) {
+    std::vector<uint16_t> addresses;
+    for (uint16_t pc = 0; pc < 4096; ++pc) {
+        if (counts[pc]) addresses.push_back(pc);
+    }
+    auto byCount = [&](uint16_t a, uint16_t b) { return counts[a] > counts[b] || (counts[a] == counts[b] && a < b); };
+    if (addresses.size() > limit) {
+        std::partial_sort(addresses.begin(), addresses.begin() + limit, addresses.end(), byCount);
+        addresses.resize(limit);
+    } else {
+        std::sort(addresses.begin(), addresses.end(), byCount);
+    }
+    return addresses;
+}
+
+bool Profiler::save(const char* path, size_t hot) const {
+    size_t length = strlen(path);
+    if (length >= 4 && strcmp(path + length - 4, ".csv") == 0) return saveCsv(path, hot);
+    return saveJson(path, hot);
+}
+
+bool Profiler::saveJson(const char* path, size_t hot) const {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"opcodes\": {", (unsigned long long)instructions());
+    const char* separator = "";
+    for (int cls = 0; cls < OP_CLASS_COUNT; ++cls) {
+        if (!classCounts[cls]) continue;
+        fprintf(file, "%s\n    \"%s\": %llu", separator, CLASS_NAMES[cls], (unsigned long long)classCounts[cls]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  },\n  \"hot_pcs\": [");
+    separator = "";
+    for (uint16_t pc : hottest(pcCounts, hot)) {
+        fprintf(file, "%s\n    { \"pc\": \"0x%03X\", \"count\": %llu }", separator, pc, (unsigned long long)pcCounts[pc]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  ],\n  \"hot_loops\": [");
+    separator = "";
+    for (uint16_t head : hottest(loopCounts, hot)) {
+        fprintf(file, "%s\n    { \"start\": \"0x%03X\", \"end\": \"0x%03X\", \"iterations\": %llu }",
+                separator, head, loopTails[head], (unsigned long long)loopCounts[head]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  ],\n  \"host_ns\": {");
+    const HostTimer* timers[] = { &emulate, &input, &draw, &latency };
+    const char* names[] = { "emulate", "input", "draw", "latency" };
+    for (int i = 0; i < 4; ++i) {
+        uint64_t count = timers[i]->count, total = timers[i]->totalNs;
+        fprintf(file, "%s\n    \"%s\": { \"calls\": %llu, \"total\": %llu, \"mean\": %llu, \"max\": %llu }",
+                i ? "," : "", names[i], (unsigned long long)count, (unsigned long long)total,
+                (unsigned long long)(count ? total / count : 0), (unsigned long long)timers[i]->maxNs.load());
+    }
+    fprintf(file, "\n  }\n}\n");
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+// One table as rows of section,key,value,extra
+bool Profiler::saveCsv(const char* path, size_t hot) const {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    fprintf(file, "section,key,count,extra\n");
+    for (int cls = 0; cls < OP_CLASS_COUNT; ++cls) {
+        if (classCounts[cls]) fprintf(file, "opcode,%s,%llu,\n", CLASS_NAMES[cls], (unsigned long long)classCounts[cls]);
+    }
+    for (uint16_t pc : hottest(pcCounts, hot)) {
+        fprintf(file, "pc,0x%03X,%llu,\n", pc, (unsigned long long)pcCounts[pc]);
+    }
+    for (uint16_t head : hottest(loopCounts, hot)) {
+        fprintf(file, "loop,0x%03X,%llu,0x%03X\n", head, (unsigned long long)loopCounts[head], loopTails[head]);
+    }
+    const HostTimer* timers[] = { &emulate, &input, &draw, &latency };
+    const char* names[] = { "emulate", "input", "draw", "latency" };
+    for (int i = 0; i < 4; ++i) {
+        uint64_t count = timers[i]->count;
+        fprintf(file, "host_ns,%s,%llu,%llu\n", names[i], (unsigned long long)count,
+                (unsigned long long)timers[i]->totalNs.load());
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,118 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+
+// Built-in profiler.
+//
+// Profiler is a trace policy (see trace.h): while chip.profiler is set,
+// runCycles dispatches through it and it counts executions per opcode class
+// and per pc, plus taken backward jumps to find hot loops. The hot path is
+// three counter increments per instruction and nothing runs at all while no
+// profiler is attached, so it can stay on in normal play. Host time per
+// frame is collected with HostTimers, which are safe to feed from the
+// render thread while the emulation thread counts instructions.
+
+// Opcode classes, with the 8XY? and FX?? sub-cases split out
+enum OpcodeClass : uint8_t {
+    OP_00E0, OP_00EE, OP_00CN, OP_00DN, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, OP_0NNN, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX30, OP_FX33, OP_FX55, OP_FX65,
+    OP_FX75, OP_FX85,
+    OP_UNKNOWN,
+    OP_CLASS_COUNT
+};
+
+OpcodeClass opcodeClass(uint16_t opcode);
+const char* opcodeClassName(OpcodeClass cls);
+
+// Count, total and worst case of a timed section, e.g. processInput per frame
+struct HostTimer {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+
+    void add(uint64_t ns) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > maxNs.load(std::memory_order_relaxed)) maxNs.store(ns, std::memory_order_relaxed);
+    }
+    void reset() { count = 0; totalNs = 0; maxNs = 0; }
+};
+
+// Adds the time until the end of the scope to `timer`; does nothing for a null timer
+class ScopedTimer {
+public:
+    explicit ScopedTimer(HostTimer* timer) : timer(timer) {
+        if (timer) start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        if (timer) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            timer->add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+private:
+    HostTimer* timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+class Profiler {
+public:
+    Profiler();
+
+    void before(const Chip8& chip, uint16_t pc) {
+        pc &= 0xFFF;
+        uint16_t opcode = chip.memory[pc] << 8 | chip.memory[(pc + 1) & 0xFFF];
+        classCounts[classes[opcode]]++;
+        pcCounts[pc]++;
+        lastPc = pc;
+        lastWasJump = (opcode & 0xF000) == 0x1000 || (opcode & 0xF000) == 0xB000;
+    }
+
+    void after(const Chip8&, uint16_t next) {
+        // A jump to itself or backwards closes a loop starting at its target
+        if (lastWasJump && (next & 0xFFF) <= lastPc) {
+            uint16_t head = next & 0xFFF;
+            loopCounts[head]++;
+            if (lastPc > loopTails[head]) loopTails[head] = lastPc;
+        }
+    }
+
+    // Host time per frame
+    HostTimer emulate;   // runFrame on the emulation thread
+    HostTimer input;     // processInput on the render thread
+    HostTimer draw;      // uploading and presenting a frame
+    HostTimer latency;   // a key press to the first frame presented after the machine took it
+
+    uint64_t classCount(OpcodeClass cls) const { return classCounts[cls]; }
+    uint64_t pcCount(uint16_t pc) const { return pcCounts[pc & 0xFFF]; }
+    uint64_t instructions() const;
+
+    void reset();
+
+    // Write everything collected so far; a path ending in ".csv" gets CSV,
+    // anything else JSON. `hot` limits the pc and loop tables to the top entries.
+    bool save(const char* path, size_t hot = 32) const;
+
+private:
+    bool saveJson(const char* path, size_t hot) const;
+    bool saveCsv(const char* path, size_t hot) const;
+
+    const uint8_t* classes;      // opcodeClass for every opcode, shared by all profilers
+
+    uint64_t classCounts[OP_CLASS_COUNT];
+    uint64_t pcCounts[4096];
+    uint64_t loopCounts[4096];   // taken backward jumps, by target
+    uint16_t loopTails[4096];    // furthest jump back to each target
+    uint16_t lastPc = 0;
+    bool lastWasJump = false;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,82 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <cstdint>
+#include <cstring>
+
+// Quirk profiles.
+//
+// CHIP-8 platforms disagree on a handful of instructions. A profile is a
+// type with the platform's choices as constants. The handlers those choices
+// affect are templates over it, and decodeOpcode picks the instantiation for
+// chip.quirks when it fills the decode cache, so the quirks cost nothing
+// while running: each profile gets its own straight-line handlers. The
+// profile is chosen when a ROM is loaded (setQuirkProfile, or quirks= in
+// roms/settings.txt).
+enum class QuirkProfile : uint8_t {
+    Modern,     // what this emulator always did: SUPER-CHIP without BXNN
+    Vip,        // the original COSMAC VIP interpreter
+    SuperChip,  // SUPER-CHIP 1.1 as modern emulators run it
+    XoChip,
+    Count
+};
+
+struct ModernQuirks {
+    static constexpr bool vfReset = false;         // 8XY1/2/3 clear VF
+    static constexpr bool memoryIncrement = false; // Fx55/Fx65 leave I at I + X + 1
+    static constexpr bool displayWait = false;     // DXYN waits for the next 60Hz tick
+    static constexpr bool wrap = false;            // sprites wrap around the edges rather than clip
+    static constexpr bool shiftVy = false;         // 8XY6/8XYE shift VY into VX, not VX in place
+    static constexpr bool jumpVx = false;          // BXNN jumps to XNN + VX, not NNN + V0
+};
+
+struct VipQuirks : ModernQuirks {
+    static constexpr bool vfReset = true;
+    static constexpr bool memoryIncrement = true;
+    static constexpr bool displayWait = true;
+    static constexpr bool shiftVy = true;
+};
+
+struct SuperChipQuirks : ModernQuirks {
+    static constexpr bool jumpVx = true;
+};
+
+struct XoChipQuirks : ModernQuirks {
+    static constexpr bool memoryIncrement = true;
+    static constexpr bool wrap = true;
+    static constexpr bool shiftVy = true;
+};
+
+// Call `f` with a value of the profile's type, so templates can be
+// instantiated for the one chosen at run time
+template <typename F>
+auto withQuirks(QuirkProfile profile, F&& f) {
+    switch (profile) {
+        case QuirkProfile::Vip: return f(VipQuirks());
+        case QuirkProfile::SuperChip: return f(SuperChipQuirks());
+        case QuirkProfile::XoChip: return f(XoChipQuirks());
+        default: return f(ModernQuirks());
+    }
+}
+
+inline const char* quirkProfileName(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::Vip: return "vip";
+        case QuirkProfile::SuperChip: return "schip";
+        case QuirkProfile::XoChip: return "xochip";
+        default: return "modern";
+    }
+}
+
+// Profile by the name quirkProfileName gives it; false if there is none
+inline bool parseQuirkProfile(const char* name, QuirkProfile& profile) {
+    for (uint8_t i = 0; i < (uint8_t)QuirkProfile::Count; ++i) {
+        if (strcmp(name, quirkProfileName((QuirkProfile)i)) == 0) {
+            profile = (QuirkProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // QUIRKS_H
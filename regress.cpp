@@ -0,0 +1,205 @@
+// ROM regression runner: runs every ROM in roms/ and roms/games/ headlessly
+// for a fixed number of frames, in parallel, and compares a hash of the final
+// display and registers against the golden file.
+//
+//   chip8_regress [--golden FILE] [--frames N] [--ipf N] [--threads N] [--jit | --aot] [--update]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "aot.h"
+#include "chip8.h"
+#include "jit.h"
+#include "thread_pool.h"
+
+struct RegressConfig {
+    std::string golden = "roms/golden.txt";
+    uint32_t frames = 3600;  // one minute of emulated time
+    uint32_t ipf = 10;
+    unsigned threads = std::thread::hardware_concurrency();
+    bool jit = false;
+    bool aot = false;        // ROMs compiled in by chip8_aotc run through their compiled code
+    bool update = false;
+};
+
+struct RomResult {
+    std::string path;
+    bool loaded = false;
+    uint64_t fbHash = 0;
+    uint64_t regHash = 0;
+};
+
+static std::vector<std::string> findRoms() {
+    std::vector<std::string> roms;
+    for (const char* dir : { "roms", "roms/games" }) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".ch8") roms.push_back(entry.path().generic_string());
+        }
+    }
+    std::sort(roms.begin(), roms.end());
+    return roms;
+}
+
+static void runRom(const RegressConfig& cfg, RomResult& result) {
+    Chip8 chip;
+    resetChip8(chip);
+    Jit* jit = cfg.jit ? createJit() : nullptr;
+    attachJit(chip, jit);
+    Aot* aot = cfg.aot ? createAot() : nullptr;
+    attachAot(chip, aot);
+    result.loaded = loadROM(result.path.c_str(), chip);
+    if (result.loaded) {
+        for (uint32_t frame = 0; frame < cfg.frames; ++frame) {
+            runFrame(chip, cfg.ipf);
+        }
+        result.fbHash = hashFramebuffer(chip);
+        result.regHash = hashRegisters(chip);
+    }
+    destroyJit(jit);
+    destroyAot(aot);
+}
+
+// Golden file format:
+//   # frames <N> ipf <N>
+//   <framebuffer hash> <register hash> <rom path>
+struct Golden {
+    uint32_t frames = 0;
+    uint32_t ipf = 0;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> hashes;
+};
+
+static bool readGolden(const std::string& path, Golden& golden) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        if (line[0] == '#') {
+            std::istringstream header(line.substr(1));
+            std::string key;
+            while (header >> key) {
+                if (key == "frames") header >> golden.frames;
+                else if (key == "ipf") header >> golden.ipf;
+            }
+            continue;
+        }
+        std::istringstream entry(line);
+        std::string fb, reg, rom;
+        entry >> fb >> reg;
+        std::getline(entry >> std::ws, rom);
+        golden.hashes[rom] = { std::strtoull(fb.c_str(), nullptr, 16), std::strtoull(reg.c_str(), nullptr, 16) };
+    }
+    return true;
+}
+
+static bool writeGolden(const std::string& path, const RegressConfig& cfg, const std::vector<RomResult>& results) {
+    std::ofstream file(path);
+    if (!file) return false;
+    file << "# frames " << cfg.frames << " ipf " << cfg.ipf << "\n";
+    char line[64];
+    for (const auto& r : results) {
+        if (!r.loaded) continue;
+        std::snprintf(line, sizeof(line), "%016llx %016llx ",
+                      (unsigned long long)r.fbHash, (unsigned long long)r.regHash);
+        file << line << r.path << "\n";
+    }
+    return true;
+}
+
+static void usage() {
+    std::cerr << "usage: chip8_regress [--golden FILE] [--frames N] [--ipf N] [--threads N] [--jit | --aot] [--update]\n";
+}
+
+int main(int argc, char* argv[]) {
+    RegressConfig cfg;
+    bool framesSet = false, ipfSet = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--golden" && hasValue) cfg.golden = argv[++i];
+        else if (arg == "--frames" && hasValue) { cfg.frames = std::strtoul(argv[++i], nullptr, 10); framesSet = true; }
+        else if (arg == "--ipf" && hasValue) { cfg.ipf = std::strtoul(argv[++i], nullptr, 10); ipfSet = true; }
+        else if (arg == "--threads" && hasValue) cfg.threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--jit") cfg.jit = true;
+        else if (arg == "--aot") cfg.aot = true;
+        else if (arg == "--update") cfg.update = true;
+        else { usage(); return 1; }
+    }
+
+    Golden golden;
+    bool haveGolden = readGolden(cfg.golden, golden);
+    if (!haveGolden && !cfg.update) {
+        std::cerr << "Can't read golden file " << cfg.golden << " (run with --update to create it)\n";
+        return 1;
+    }
+    // Unless overridden, replay the run length the golden hashes were recorded with
+    if (haveGolden && !cfg.update) {
+        if (!framesSet && golden.frames) cfg.frames = golden.frames;
+        if (!ipfSet && golden.ipf) cfg.ipf = golden.ipf;
+    }
+
+    std::vector<RomResult> results;
+    for (const auto& path : findRoms()) {
+        results.emplace_back();
+        results.back().path = path;
+    }
+
+    // The core logs unknown opcodes; with a hundred ROMs in parallel that's just noise
+    std::cout.setstate(std::ios::failbit);
+    std::cerr.setstate(std::ios::failbit);
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(cfg.threads);
+        for (auto& result : results) {
+            pool.submit([&cfg, &result] { runRom(cfg, result); });
+        }
+        pool.wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.clear();
+    std::cerr.clear();
+
+    if (cfg.update) {
+        if (!writeGolden(cfg.golden, cfg, results)) {
+            std::cerr << "Can't write golden file " << cfg.golden << "\n";
+            return 1;
+        }
+        std::printf("Wrote %zu hashes to %s (%.2fs)\n", results.size(), cfg.golden.c_str(), seconds);
+        return 0;
+    }
+
+    int failures = 0;
+    for (const auto& r : results) {
+        auto it = golden.hashes.find(r.path);
+        if (!r.loaded) {
+            std::printf("ERROR    %s: failed to load\n", r.path.c_str());
+            failures++;
+        } else if (it == golden.hashes.end()) {
+            std::printf("NEW      %s: %016llx %016llx\n", r.path.c_str(),
+                        (unsigned long long)r.fbHash, (unsigned long long)r.regHash);
+        } else if (it->second.first != r.fbHash || it->second.second != r.regHash) {
+            std::printf("MISMATCH %s:%s%s\n", r.path.c_str(),
+                        it->second.first != r.fbHash ? " framebuffer" : "",
+                        it->second.second != r.regHash ? " registers" : "");
+            failures++;
+        }
+    }
+    for (const auto& entry : golden.hashes) {
+        bool found = std::any_of(results.begin(), results.end(),
+                                 [&](const RomResult& r) { return r.path == entry.first; });
+        if (!found) std::printf("MISSING  %s\n", entry.first.c_str());
+    }
+
+    std::printf("%zu ROMs, %d failures, %u frames each, %.2fs\n", results.size(), failures, cfg.frames, seconds);
+    return failures ? 1 : 0;
+}
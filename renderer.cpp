@@ -0,0 +1,83 @@
+#include "renderer.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "chip8.h"
+
+bool createRenderer(Renderer& renderer, SDL_Window* window) {
+    renderer.sdl = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (!renderer.sdl) {
+        std::cerr << "SDL_CreateRenderer Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    // Let SDL scale the 128x64 texture to the window, keeping the aspect ratio
+    SDL_RenderSetLogicalSize(renderer.sdl, 128, 64);
+
+    renderer.texture = SDL_CreateTexture(renderer.sdl, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING, 128, 64);
+    if (!renderer.texture) {
+        std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+        SDL_DestroyRenderer(renderer.sdl);
+        renderer.sdl = nullptr;
+        return false;
+    }
+
+    // Start from a blank texture
+    uint32_t blank[128];
+    for (auto& pixel : blank) pixel = renderer.offColor;
+    for (int y = 0; y < 64; ++y) {
+        SDL_Rect row = { 0, y, 128, 1 };
+        SDL_UpdateTexture(renderer.texture, &row, blank, sizeof(blank));
+    }
+    return true;
+}
+
+void destroyRenderer(Renderer& renderer) {
+    if (renderer.texture) SDL_DestroyTexture(renderer.texture);
+    if (renderer.sdl) SDL_DestroyRenderer(renderer.sdl);
+    renderer.texture = nullptr;
+    renderer.sdl = nullptr;
+}
+
+void uploadFrame(Renderer& renderer, const uint64_t* gfx, bool hires) {
+    // After a mode switch every row means something else
+    const bool all = hires != renderer.hires;
+    renderer.hires = hires;
+    const int height = screenHeight(hires);
+    const int stride = hires ? 2 : 1;
+    const int scale = hires ? 1 : 2;
+    auto changed = [&](int y) {
+        return all || memcmp(gfx + y * stride, renderer.shown + y * stride, stride * sizeof(uint64_t)) != 0;
+    };
+
+    uint32_t pixels[64][128];
+    int y = 0;
+    while (y < height) {
+        if (!changed(y)) {
+            y++;
+            continue;
+        }
+        // Upload each run of consecutive changed rows with one call
+        int first = y;
+        for (; y < height && changed(y); ++y) {
+            const uint64_t* row = gfx + y * stride;
+            uint32_t* line = pixels[y * scale];
+            for (int x = 0; x < 128; ++x) {
+                int px = x / scale;
+                line[x] = (row[px >> 6] >> (63 - (px & 63))) & 1 ? renderer.onColor : renderer.offColor;
+            }
+            if (scale == 2) memcpy(pixels[y * 2 + 1], line, sizeof(pixels[0]));
+            memcpy(renderer.shown + y * stride, row, stride * sizeof(uint64_t));
+        }
+        SDL_Rect rows = { 0, first * scale, 128, (y - first) * scale };
+        SDL_UpdateTexture(renderer.texture, &rows, pixels[first * scale], sizeof(pixels[0]));
+    }
+}
+
+void presentFrame(Renderer& renderer) {
+    SDL_SetRenderDrawColor(renderer.sdl, 0, 0, 0, 255);
+    SDL_RenderClear(renderer.sdl);
+    SDL_RenderCopy(renderer.sdl, renderer.texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer.sdl);
+}
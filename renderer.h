@@ -0,0 +1,31 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstdint>
+#include <SDL2/SDL.h>
+
+// Keeps the display in a 128x64 streaming texture, lo-res frames drawn with
+// 2x2 pixels. Only rows that differ from what was last uploaded are sent
+// again, and the texture is stretched to the window with a single copy per
+// present.
+struct Renderer {
+    SDL_Renderer* sdl = nullptr;
+    SDL_Texture* texture = nullptr;
+    uint32_t onColor = 0xFFFFFFFF;  // ARGB
+    uint32_t offColor = 0xFF000000;
+    uint64_t shown[128] = {};       // rows as currently held by the texture, packed like Chip8::gfx
+    bool hires = false;             // mode of the frame in shown
+};
+
+bool createRenderer(Renderer& renderer, SDL_Window* window);
+void destroyRenderer(Renderer& renderer);
+
+// Upload the rows of a packed frame (see Screen) that changed since the last
+// upload; everything, if the mode changed.
+// Diffing here rather than trusting Chip8::dirtyRows means frames the
+// renderer never saw (see TripleBuffer) can't leave stale rows behind.
+void uploadFrame(Renderer& renderer, const uint64_t* gfx, bool hires);
+// Copy the texture to the window and present it
+void presentFrame(Renderer& renderer);
+
+#endif // RENDERER_H
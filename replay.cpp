@@ -0,0 +1,146 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "chip8.h"
+
+// Input log file: header, the starting SaveState, then the events
+static const char INPUTLOG_MAGIC[4] = { 'C', '8', 'I', 'N' };
+static const uint32_t INPUTLOG_VERSION = 1;
+
+struct InputLogHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t ips;
+    uint32_t reserved;
+    uint64_t end;
+    uint64_t eventCount;
+};
+
+static uint16_t packKeys(const uint8_t* keypad) {
+    uint16_t keys = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (keypad[i]) keys |= 1 << i;
+    }
+    return keys;
+}
+
+void beginRecording(InputLog& log, const Chip8& chip, uint32_t ips) {
+    log.ips = ips;
+    log.end = chip.instructionCount;
+    log.events.clear();
+    captureState(chip, log.start);
+}
+
+void recordKeys(InputLog& log, const Chip8& chip, uint16_t keys) {
+    uint16_t current = log.events.empty() ? packKeys(log.start.keypad) : log.events.back().keys;
+    if (keys == current) return;
+
+    // Several changes before the same instruction (frames with no instructions): keep the last
+    if (!log.events.empty() && log.events.back().instruction == chip.instructionCount) {
+        log.events.back().keys = keys;
+        return;
+    }
+    InputEvent event = {};
+    event.instruction = chip.instructionCount;
+    event.keys = keys;
+    log.events.push_back(event);
+}
+
+void truncateLog(InputLog& log, uint64_t instruction) {
+    while (!log.events.empty() && log.events.back().instruction >= instruction) {
+        log.events.pop_back();
+    }
+}
+
+void finishRecording(InputLog& log, const Chip8& chip) {
+    log.end = chip.instructionCount;
+}
+
+bool saveInputLog(const InputLog& log, const char* path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    InputLogHeader header = {};
+    memcpy(header.magic, INPUTLOG_MAGIC, sizeof(header.magic));
+    header.version = INPUTLOG_VERSION;
+    header.ips = log.ips;
+    header.end = log.end;
+    header.eventCount = log.events.size();
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&log.start, sizeof(log.start));
+    file.write((const char*)log.events.data(), log.events.size() * sizeof(InputEvent));
+    return (bool)file;
+}
+
+bool loadInputLog(InputLog& log, const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    InputLogHeader header;
+    if (!file.read((char*)&header, sizeof(header))) return false;
+    if (memcmp(header.magic, INPUTLOG_MAGIC, sizeof(header.magic)) != 0 || header.version != INPUTLOG_VERSION) {
+        return false;
+    }
+    // The events must be what's left after the state, so a corrupt count can't ask for gigabytes
+    std::streamoff offset = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - offset - (std::streamoff)sizeof(SaveState);
+    file.seekg(offset);
+    if (remaining < 0 || header.eventCount > (uint64_t)remaining / sizeof(InputEvent)) return false;
+
+    log.ips = header.ips;
+    log.end = header.end;
+    log.events.resize(header.eventCount);
+    file.read((char*)&log.start, sizeof(log.start));
+    file.read((char*)log.events.data(), header.eventCount * sizeof(InputEvent));
+    return (bool)file;
+}
+
+bool beginReplay(Replay& replay, Chip8& chip, const InputLog& log) {
+    if (!restoreState(chip, log.start)) return false;
+    replay.log = &log;
+    replay.nextEvent = 0;
+    replay.frameRemaining = instructionsForFrame(log.ips, chip.frames);
+    return true;
+}
+
+void runReplay(Replay& replay, Chip8& chip, uint64_t instruction) {
+    const InputLog& log = *replay.log;
+    instruction = std::min(instruction, log.end);
+
+    while (chip.instructionCount < instruction) {
+        while (replay.nextEvent < log.events.size() && log.events[replay.nextEvent].instruction <= chip.instructionCount) {
+            uint16_t keys = log.events[replay.nextEvent++].keys;
+            for (int i = 0; i < 16; ++i) {
+                chip.keypad[i] = (keys >> i) & 1;
+            }
+        }
+
+        // Run up to whichever comes first: the end of the frame, the next input change or the target
+        uint64_t n = instruction - chip.instructionCount;
+        if (replay.nextEvent < log.events.size()) {
+            n = std::min(n, log.events[replay.nextEvent].instruction - chip.instructionCount);
+        }
+        if (log.ips == IPS_VIP) {
+            // The frame ends where its cycles run out
+            if (runCyclesTimed(chip, n)) tickTimers(chip);
+            continue;
+        }
+        n = std::min<uint64_t>(n, replay.frameRemaining);
+        runInstructions(chip, n);
+        replay.frameRemaining -= (uint32_t)n;
+
+        if (replay.frameRemaining == 0) {
+            tickTimers(chip);
+            replay.frameRemaining = instructionsForFrame(log.ips, chip.frames);
+        }
+    }
+}
+
+void seekReplay(Replay& replay, Chip8& chip, uint64_t instruction) {
+    if (instruction < chip.instructionCount) {
+        beginReplay(replay, chip, *replay.log);
+    }
+    runReplay(replay, chip, instruction);
+}
@@ -0,0 +1,61 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "savestate.h"
+
+struct Chip8;
+
+// Deterministic input recording and replay.
+//
+// A session is its starting SaveState (ROM, RNG seed and all) plus every
+// keypad change, stamped with chip.instructionCount rather than wall time.
+// Frames follow instructionsForFrame(ips, chip.frames) (or the VIP's cycle
+// budget, for an ips of IPS_VIP) both when recording and when replaying, so
+// a replay executes exactly the same instruction stream, at whatever speed
+// the host can manage.
+
+// Keypad state from instruction `instruction` on, bit per key
+struct InputEvent {
+    uint64_t instruction;
+    uint16_t keys;
+    uint8_t reserved[6];
+};
+
+struct InputLog {
+    uint32_t ips = 700;
+    uint64_t end = 0;        // instruction count when recording stopped
+    SaveState start;
+    std::vector<InputEvent> events;
+};
+
+// Start a log from the chip's current state, which must be between frames
+void beginRecording(InputLog& log, const Chip8& chip, uint32_t ips);
+// Call with the keys about to be applied, before the instruction that should
+// see them first: between frames or part way through one
+void recordKeys(InputLog& log, const Chip8& chip, uint16_t keys);
+// Forget input at or after `instruction`, e.g. after rewinding
+void truncateLog(InputLog& log, uint64_t instruction);
+void finishRecording(InputLog& log, const Chip8& chip);
+
+bool saveInputLog(const InputLog& log, const char* path);
+bool loadInputLog(InputLog& log, const char* path);
+
+struct Replay {
+    const InputLog* log = nullptr;
+    size_t nextEvent = 0;
+    uint32_t frameRemaining = 0; // instructions left in the current frame
+};
+
+// Restore the log's starting state into `chip`
+bool beginReplay(Replay& replay, Chip8& chip, const InputLog& log);
+// Run forward until chip.instructionCount reaches `instruction` (the
+// recording's end at most), applying input and timer ticks exactly as recorded
+void runReplay(Replay& replay, Chip8& chip, uint64_t instruction);
+// Like runReplay, but seeking backwards restarts from the beginning
+void seekReplay(Replay& replay, Chip8& chip, uint64_t instruction);
+
+#endif // REPLAY_H
@@ -0,0 +1,111 @@
+#include "rewind.h"
+
+#include <cstring>
+
+#include "chip8.h"
+
+RewindBuffer::RewindBuffer(size_t capacityFrames, size_t keyframeInterval)
+    : capacity(capacityFrames ? capacityFrames : 1),
+      interval(keyframeInterval ? keyframeInterval : 1) {
+}
+
+// Delta encoding of the XOR between two states, as a sequence of
+//   uint16 run of unchanged bytes, uint16 count of changed bytes, the XORed bytes
+void RewindBuffer::encodeDelta(const SaveState& base, const SaveState& state, std::vector<uint8_t>& out) {
+    const uint8_t* a = (const uint8_t*)&base;
+    const uint8_t* b = (const uint8_t*)&state;
+    const size_t size = sizeof(SaveState);
+
+    size_t i = 0;
+    while (i < size) {
+        size_t skip = 0;
+        while (i < size && a[i] == b[i] && skip < 0xFFFF) { i++; skip++; }
+        size_t start = i, count = 0;
+        while (i < size && a[i] != b[i] && count < 0xFFFF) { i++; count++; }
+        if (count == 0 && i == size) break; // trailing unchanged bytes need no entry
+
+        uint16_t header[2] = { (uint16_t)skip, (uint16_t)count };
+        out.insert(out.end(), (const uint8_t*)header, (const uint8_t*)header + sizeof(header));
+        for (size_t j = start; j < start + count; ++j) {
+            out.push_back(a[j] ^ b[j]);
+        }
+    }
+}
+
+void RewindBuffer::decodeDelta(const uint8_t* data, size_t size, SaveState& state) {
+    uint8_t* out = (uint8_t*)&state;
+    size_t pos = 0, i = 0;
+    while (i + 4 <= size) {
+        uint16_t header[2];
+        memcpy(header, data + i, sizeof(header));
+        i += sizeof(header);
+        pos += header[0];
+        for (uint16_t j = 0; j < header[1]; ++j) {
+            out[pos++] ^= data[i++];
+        }
+    }
+}
+
+void RewindBuffer::push(const Chip8& chip) {
+    captureState(chip, scratch);
+
+    if (groups.empty() || groups.back().size() >= interval) {
+        groups.emplace_back();
+        groups.back().keyframe = scratch;
+    } else {
+        Group& group = groups.back();
+        group.offsets.push_back((uint32_t)group.deltas.size());
+        encodeDelta(group.keyframe, scratch, group.deltas);
+    }
+    frameCount++;
+
+    // Drop whole groups from the front; their deltas are useless without the keyframe
+    while (frameCount - groups.front().size() >= capacity && groups.size() > 1) {
+        frameCount -= groups.front().size();
+        groups.pop_front();
+    }
+}
+
+bool RewindBuffer::rewind(Chip8& chip, size_t framesBack) {
+    if (framesBack >= frameCount) return false;
+
+    // Walk back to the group holding the target frame, discarding newer groups
+    size_t target = frameCount - 1 - framesBack; // index from the oldest held frame
+    size_t groupStart = frameCount;
+    while (true) {
+        groupStart -= groups.back().size();
+        if (groupStart <= target) break;
+        frameCount -= groups.back().size();
+        groups.pop_back();
+    }
+
+    Group& group = groups.back();
+    size_t index = target - groupStart; // 0 = keyframe
+    scratch = group.keyframe;
+    if (index > 0) {
+        size_t begin = group.offsets[index - 1];
+        size_t end = index < group.offsets.size() ? group.offsets[index] : group.deltas.size();
+        decodeDelta(group.deltas.data() + begin, end - begin, scratch);
+    }
+
+    // Forget the frames after the target within its group too
+    if (index < group.offsets.size()) {
+        group.deltas.resize(group.offsets[index]);
+        frameCount -= group.offsets.size() - index;
+        group.offsets.resize(index);
+    }
+    return restoreState(chip, scratch);
+}
+
+size_t RewindBuffer::memoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto& group : groups) {
+        bytes += sizeof(Group) + group.deltas.capacity() + group.offsets.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+void RewindBuffer::clear() {
+    groups.clear();
+    frameCount = 0;
+}
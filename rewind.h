@@ -0,0 +1,52 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "savestate.h"
+
+// Per-frame history for rewinding.
+//
+// Every `keyframeInterval` frames a full SaveState is kept; the frames in
+// between are stored as the XOR against that keyframe, run-length encoded
+// (a frame usually differs from its keyframe in a handful of bytes). Going
+// back to any frame is one keyframe copy plus one delta decode, so it costs
+// the same no matter how far back it is.
+class RewindBuffer {
+public:
+    // Five minutes at 60 frames per second by default
+    explicit RewindBuffer(size_t capacityFrames = 5 * 60 * 60, size_t keyframeInterval = 60);
+
+    // Record the state at the end of a frame
+    void push(const Chip8& chip);
+
+    // Restore the state from `framesBack` frames ago (0 = the last push) and
+    // drop everything newer. Returns false if the history isn't that long.
+    bool rewind(Chip8& chip, size_t framesBack);
+
+    size_t frames() const { return frameCount; }
+    size_t memoryUsage() const;
+    void clear();
+
+private:
+    struct Group {
+        SaveState keyframe;
+        std::vector<uint8_t> deltas;      // encoded deltas, back to back
+        std::vector<uint32_t> offsets;    // start of each delta in `deltas`
+        size_t size() const { return 1 + offsets.size(); }
+    };
+
+    static void encodeDelta(const SaveState& base, const SaveState& state, std::vector<uint8_t>& out);
+    static void decodeDelta(const uint8_t* data, size_t size, SaveState& state);
+
+    size_t capacity;
+    size_t interval;
+    size_t frameCount = 0;
+    std::deque<Group> groups;
+    SaveState scratch;
+};
+
+#endif // REWIND_H
@@ -0,0 +1,198 @@
+#include "romlib.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+RomLibrary::~RomLibrary() {
+    for (const Mapping& mapping : mappings) {
+        if (mapping.address) munmap(mapping.address, mapping.size);
+    }
+}
+
+// Index file: a header line, then "<hash> <size> <mtime> <path>" per ROM
+static const char* const INDEX_HEADER = "# chip8 rom index v1";
+
+struct IndexRecord {
+    uint64_t hash;
+    uint64_t size;
+    int64_t mtime;
+};
+
+static std::unordered_map<std::string, IndexRecord> readIndex(const char* path) {
+    std::unordered_map<std::string, IndexRecord> index;
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line) || line != INDEX_HEADER) return index;
+
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        IndexRecord record;
+        std::string romPath;
+        fields >> std::hex >> record.hash >> std::dec >> record.size >> record.mtime;
+        fields.get(); // the single space before the path, which may itself contain spaces
+        if (fields && std::getline(fields, romPath)) index[romPath] = record;
+    }
+    return index;
+}
+
+static std::string readText(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) return std::string();
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+void RomLibrary::scan(const std::vector<std::string>& dirs, const char* indexPath) {
+    std::vector<std::string> paths;
+    for (const std::string& dir : dirs) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".ch8") paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::unordered_map<std::string, IndexRecord> index = readIndex(indexPath);
+    bool indexChanged = false;
+
+    for (const std::string& path : paths) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || info.st_size == 0) continue;
+
+        RomEntry rom;
+        rom.path = path;
+        rom.title = std::filesystem::path(path).stem().string();
+        rom.info = readText(std::filesystem::path(path).replace_extension(".txt").string());
+        rom.size = (uint64_t)info.st_size;
+        rom.mtime = (int64_t)info.st_mtime;
+        entries.push_back(rom);
+        mappings.emplace_back();
+
+        auto cached = index.find(path);
+        if (cached != index.end() && cached->second.size == rom.size && cached->second.mtime == rom.mtime) {
+            entries.back().hash = cached->second.hash;
+        } else if (hashEntry(entries.size() - 1)) {
+            indexChanged = true;
+        } else {
+            entries.pop_back();
+            mappings.pop_back();
+            continue;
+        }
+        // The first path wins for duplicate images
+        byHash.emplace(entries.back().hash, entries.size() - 1);
+    }
+
+    // Also drop records of ROMs that have gone away
+    indexChanged = indexChanged || index.size() != entries.size();
+    if (indexChanged && indexPath) {
+        std::ofstream file(indexPath);
+        file << INDEX_HEADER << "\n";
+        char hash[17];
+        for (const RomEntry& rom : entries) {
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)rom.hash);
+            file << hash << " " << rom.size << " " << rom.mtime << " " << rom.path << "\n";
+        }
+        if (!file) std::cerr << "Failed to write ROM index: " << indexPath << std::endl;
+    }
+}
+
+bool RomLibrary::hashEntry(size_t i) {
+    const uint8_t* data = image(i);
+    if (!data) return false;
+    entries[i].hash = hashData(data, entries[i].size);
+    return true;
+}
+
+bool RomLibrary::loadSettings(const char* path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        uint64_t hash;
+        if (!(fields >> std::hex >> hash)) continue;
+
+        int i = find(hash);
+        std::string setting;
+        while (fields >> setting) {
+            size_t equals = setting.find('=');
+            if (i < 0 || equals == std::string::npos) continue;
+            entries[i].settings[setting.substr(0, equals)] = setting.substr(equals + 1);
+        }
+    }
+    return true;
+}
+
+int RomLibrary::find(uint64_t hash) const {
+    auto it = byHash.find(hash);
+    return it == byHash.end() ? -1 : (int)it->second;
+}
+
+int RomLibrary::findPath(const std::string& path) const {
+    std::error_code ec;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].path == path || std::filesystem::equivalent(entries[i].path, path, ec)) return (int)i;
+    }
+    return -1;
+}
+
+const uint8_t* RomLibrary::image(size_t i) {
+    Mapping& mapping = mappings[i];
+    if (mapping.address) return (const uint8_t*)mapping.address;
+
+    int fd = open(entries[i].path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    void* address = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (uint64_t)info.st_size == entries[i].size) {
+        address = mmap(nullptr, entries[i].size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping keeps the file alive
+    if (address == MAP_FAILED) return nullptr;
+
+    mapping.address = address;
+    mapping.size = entries[i].size;
+    return (const uint8_t*)address;
+}
+
+bool RomLibrary::load(Chip8& chip, size_t i) {
+    const uint8_t* data = image(i);
+    if (!data) {
+        std::cout << "Failed to open ROM: " << entries[i].path << std::endl;
+        return false;
+    }
+    if (!loadROMData(chip, data, entries[i].size)) return false;
+    std::cout << "Successfully loaded ROM: " << entries[i].path << std::endl;
+    return true;
+}
+
+uint32_t romSetting(const RomEntry& rom, const char* key, uint32_t fallback) {
+    auto it = rom.settings.find(key);
+    if (it == rom.settings.end()) return fallback;
+    const std::string& value = it->second;
+    if (value == "vip") return IPS_VIP;
+    // 0 would read as IPS_VIP too, so that has to be spelled out
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long number = std::strtoull(value.c_str(), &end, 0);
+    if (value.empty() || value[0] == '-' || *end != '\0' || errno == ERANGE || number == 0 || number > UINT32_MAX) {
+        std::cerr << "Bad setting " << key << "=" << value << " for " << rom.path << ", using the default" << std::endl;
+        return fallback;
+    }
+    return (uint32_t)number;
+}
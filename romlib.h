@@ -0,0 +1,74 @@
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Chip8;
+
+// ROM library.
+//
+// Scans ROM directories once, pairs every .ch8 with the .txt next to it and
+// identifies images by a content hash, so per-ROM settings follow a game
+// whatever its file is called. Hashes are cached in an index file keyed by
+// path, size and modification time; a warm start doesn't read a single ROM.
+// Images are memory-mapped on first use and stay mapped for the library's
+// lifetime, so switching games is a copy out of the page cache.
+
+struct RomEntry {
+    std::string path;
+    std::string title;       // file name without the extension
+    std::string info;        // contents of the matching .txt, if there is one
+    uint64_t hash = 0;       // hashData of the image
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::map<std::string, std::string> settings; // from the settings file, by hash
+};
+
+class RomLibrary {
+public:
+    RomLibrary() = default;
+    ~RomLibrary();
+    RomLibrary(const RomLibrary&) = delete;
+    RomLibrary& operator=(const RomLibrary&) = delete;
+
+    // Add every .ch8 in `dirs` (not recursive), in path order. Hashes are
+    // taken from `indexPath` when size and mtime still match, and the index
+    // is rewritten if anything had to be hashed.
+    void scan(const std::vector<std::string>& dirs, const char* indexPath);
+    // Per-ROM settings: lines of "<hash> key=value ...", '#' starts a comment
+    bool loadSettings(const char* path);
+
+    size_t size() const { return entries.size(); }
+    const RomEntry& at(size_t i) const { return entries[i]; }
+    // Index of the entry, or -1
+    int find(uint64_t hash) const;
+    int findPath(const std::string& path) const;
+
+    // The mapped image, nullptr if the file can't be mapped any more
+    const uint8_t* image(size_t i);
+    // Copy entry i into chip memory at 0x200
+    bool load(Chip8& chip, size_t i);
+
+private:
+    struct Mapping {
+        void* address = nullptr;
+        size_t size = 0;
+    };
+
+    bool hashEntry(size_t i);
+
+    std::vector<RomEntry> entries;
+    std::vector<Mapping> mappings;
+    std::unordered_map<uint64_t, size_t> byHash;
+};
+
+// A setting as a positive number, or IPS_VIP for `vip`; `fallback` if the
+// ROM doesn't set it or sets it to anything else (which prints a warning)
+uint32_t romSetting(const RomEntry& rom, const char* key, uint32_t fallback);
+
+#endif // ROMLIB_H
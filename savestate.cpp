@@ -0,0 +1,90 @@
+#include "savestate.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "chip8.h"
+
+static const char SAVESTATE_MAGIC[4] = { 'C', '8', 'S', 'S' };
+
+void captureState(const Chip8& chip, SaveState& state) {
+    memset(&state, 0, sizeof(state));
+    memcpy(state.magic, SAVESTATE_MAGIC, sizeof(state.magic));
+    state.version = SAVESTATE_VERSION;
+    memcpy(state.memory, chip.memory, sizeof(state.memory));
+    memcpy(state.gfx, chip.gfx, sizeof(state.gfx));
+    memcpy(state.stack, chip.stack, sizeof(state.stack));
+    memcpy(state.V, chip.V, sizeof(state.V));
+    memcpy(state.keypad, chip.keypad, sizeof(state.keypad));
+    memcpy(state.rplFlags, chip.rplFlags, sizeof(state.rplFlags));
+    state.I = chip.I;
+    state.pc = chip.pc;
+    state.sp = chip.sp;
+    state.delay_timer = chip.delay_timer;
+    state.sound_timer = chip.sound_timer;
+    state.rng = chip.rng;
+    state.hires = chip.hires;
+    state.quirks = (uint8_t)chip.quirks;
+    state.vblank = chip.vblank;
+    state.drawWait = chip.drawWait;
+    state.instructionCount = chip.instructionCount;
+    state.frames = chip.frames;
+    state.cycles = chip.cycles;
+    state.cycleDeadline = chip.cycleDeadline;
+    state.keyWaitHeld = chip.keyWaitHeld;
+    state.keyWaitPressed = chip.keyWaitPressed;
+    state.keyWait = chip.keyWait;
+}
+
+bool restoreState(Chip8& chip, const SaveState& state) {
+    if (memcmp(state.magic, SAVESTATE_MAGIC, sizeof(state.magic)) != 0 || state.version != SAVESTATE_VERSION ||
+        state.quirks >= (uint8_t)QuirkProfile::Count) {
+        return false;
+    }
+    memcpy(chip.memory, state.memory, sizeof(chip.memory));
+    memcpy(chip.gfx, state.gfx, sizeof(chip.gfx));
+    memcpy(chip.stack, state.stack, sizeof(chip.stack));
+    memcpy(chip.V, state.V, sizeof(chip.V));
+    memcpy(chip.keypad, state.keypad, sizeof(chip.keypad));
+    memcpy(chip.rplFlags, state.rplFlags, sizeof(chip.rplFlags));
+    chip.I = state.I;
+    chip.pc = state.pc;
+    chip.sp = state.sp;
+    chip.delay_timer = state.delay_timer;
+    chip.sound_timer = state.sound_timer;
+    chip.rng = state.rng;
+    chip.hires = state.hires != 0;
+    chip.quirks = (QuirkProfile)state.quirks;
+    chip.vblank = state.vblank != 0;
+    chip.drawWait = state.drawWait != 0;
+    chip.instructionCount = state.instructionCount;
+    chip.frames = state.frames;
+    chip.cycles = state.cycles;
+    chip.cycleDeadline = state.cycleDeadline;
+    chip.keyWaitHeld = state.keyWaitHeld;
+    chip.keyWaitPressed = state.keyWaitPressed;
+    chip.keyWait = state.keyWait != 0;
+
+    // Memory (and maybe the quirk profile) was replaced wholesale, so nothing
+    // decoded or compiled is valid any more
+    invalidateDecodeCache(chip);
+    chip.dirtyRows = allRows(chip.hires);
+    chip.drawFlag = true;
+    return true;
+}
+
+bool saveStateToFile(const Chip8& chip, const char* path) {
+    SaveState state;
+    captureState(chip, state);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file.write((const char*)&state, sizeof(state));
+    return (bool)file;
+}
+
+bool loadStateFromFile(Chip8& chip, const char* path) {
+    SaveState state;
+    std::ifstream file(path, std::ios::binary);
+    if (!file || !file.read((char*)&state, sizeof(state))) return false;
+    return restoreState(chip, state);
+}
@@ -0,0 +1,54 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <cstdint>
+
+struct Chip8;
+
+// Snapshot of everything a running ROM can observe.
+//
+// The layout is fixed and versioned: a save file is this struct written
+// as-is (little-endian hosts), so loading is a single read plus a copy into
+// the Chip8 with nothing to parse. Bump SAVESTATE_VERSION whenever a field
+// is added, moved or resized.
+const uint32_t SAVESTATE_VERSION = 6;
+
+struct SaveState {
+    char magic[4];           // "C8SS"
+    uint32_t version;
+    uint8_t memory[4096];
+    uint64_t gfx[128];       // 32 rows of one word in lo-res, 64 rows of two in hi-res
+    uint16_t stack[16];
+    uint8_t V[16];
+    uint8_t keypad[16];
+    uint8_t rplFlags[16];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint32_t rng;
+    uint8_t hires;
+    uint8_t quirks;          // QuirkProfile
+    uint8_t vblank;
+    uint8_t drawWait;
+    uint64_t instructionCount;
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t cycleDeadline;
+    uint16_t keyWaitHeld;
+    uint16_t keyWaitPressed;
+    uint8_t keyWait;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(SaveState) == 5264, "SaveState layout changed, bump SAVESTATE_VERSION");
+
+void captureState(const Chip8& chip, SaveState& state);
+// Returns false (leaving chip untouched) if the state has the wrong magic or version
+bool restoreState(Chip8& chip, const SaveState& state);
+
+bool saveStateToFile(const Chip8& chip, const char* path);
+bool loadStateFromFile(Chip8& chip, const char* path);
+
+#endif // SAVESTATE_H
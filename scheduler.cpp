@@ -0,0 +1,291 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "aot.h"
+#include "jit.h"
+#include "profiler.h"
+#include "savestate.h"
+
+static void publishFrame(EmulationThread& emu, uint64_t number) {
+    Frame& frame = emu.frames.back();
+    memcpy(frame.gfx, emu.chip->gfx, sizeof(frame.gfx));
+    frame.hires = emu.chip->hires;
+    frame.number = number;
+    frame.inputTime = emu.pressTime;
+    emu.pressTime = 0;
+    emu.frames.publish();
+    if (emu.broadcast) emu.broadcast->publish(emu.chip->gfx, emu.chip->hires, number);
+}
+
+static void handleStateRequest(EmulationThread& emu) {
+    StateRequest request = emu.stateRequest.exchange(StateRequest::None, std::memory_order_relaxed);
+    if (request == StateRequest::None) return;
+
+    const char* path = emu.config.statePath.c_str();
+    if (request == StateRequest::Save) {
+        if (saveStateToFile(*emu.chip, path)) std::cout << "Saved state to " << path << std::endl;
+        else std::cerr << "Failed to save state: " << path << std::endl;
+    } else {
+        if (loadStateFromFile(*emu.chip, path)) {
+            std::cout << "Loaded state from " << path << std::endl;
+            // A replay can only start from one state, so the recording starts over
+            // from here, and rewinding past this point would leave the log behind
+            if (emu.recording) {
+                beginRecording(*emu.recording, *emu.chip, emu.ips);
+                emu.history.clear();
+            }
+        } else std::cerr << "Failed to load state: " << path << std::endl;
+    }
+}
+
+// Swap in another ROM from the library without stopping the thread; the
+// Jit, compiled ROMs, profiler and trace stay attached
+static void switchRom(EmulationThread& emu, int index) {
+    if (!emu.library || index < 0 || index >= (int)emu.library->size()) return;
+    Chip8& chip = *emu.chip;
+    const RomEntry& rom = emu.library->at(index);
+
+    Jit* jit = chip.jit;
+    Aot* aot = chip.aot;
+    Profiler* profiler = chip.profiler;
+    TraceRing* trace = chip.trace;
+    bool idleSkip = chip.idleSkip;
+    resetChip8(chip);
+    attachJit(chip, jit);
+    attachAot(chip, aot);
+    chip.profiler = profiler;
+    chip.trace = trace;
+    chip.idleSkip = idleSkip;
+    seedRandom(chip, emu.config.seed);
+    if (!emu.library->load(chip, index)) return;
+
+    QuirkProfile quirks = emu.config.quirks;
+    auto setting = rom.settings.find("quirks");
+    if (!emu.config.forceQuirks && setting != rom.settings.end() && !parseQuirkProfile(setting->second.c_str(), quirks)) {
+        std::cout << "Unknown quirk profile " << setting->second << " for " << rom.path << std::endl;
+    }
+    setQuirkProfile(chip, quirks);
+    // ips=vip reads as IPS_VIP
+    emu.ips = emu.config.forceIps ? emu.config.ips : romSetting(rom, "ips", emu.config.ips);
+    emu.config.statePath = rom.path + ".state";
+    emu.history.clear();
+    if (emu.recording) beginRecording(*emu.recording, chip, emu.ips);
+    emu.currentRom.store(index, std::memory_order_relaxed);
+}
+
+// Render the frame just run and hand it to the audio output. Never waits: if
+// the output is behind, the rest of the frame is dropped.
+static void playFrame(EmulationThread& emu, uint64_t frameStart, uint32_t instructions, bool soundOn,
+                      std::vector<int16_t>& samples) {
+    samples.clear();
+    renderBuzzerFrame(emu.buzzer, *emu.chip, frameStart, instructions, soundOn, samples);
+    size_t pushed = emu.audio->push(samples.data(), samples.size());
+    if (pushed < samples.size()) {
+        emu.droppedSamples.fetch_add(samples.size() - pushed, std::memory_order_relaxed);
+    }
+}
+
+static void saveProfile(EmulationThread& emu) {
+    Profiler* profiler = emu.chip->profiler;
+    if (!profiler || emu.config.profilePath.empty()) return;
+    if (!profiler->save(emu.config.profilePath.c_str())) {
+        std::cerr << "Failed to write profile: " << emu.config.profilePath << std::endl;
+    }
+}
+
+// Carry out debugger commands queued since the last frame
+static void handleDebugCommands(EmulationThread& emu) {
+    std::vector<std::string> commands;
+    {
+        std::lock_guard<std::mutex> lock(emu.debugMutex);
+        commands.swap(emu.debugCommands);
+    }
+    for (const std::string& line : commands) {
+        emu.debugger->command(*emu.chip, line, std::cout);
+    }
+    std::cout << std::flush;
+}
+
+// Apply a key event taken off the queue: the keypad follows it from the
+// next instruction on, and a recording logs it there
+static void applyKeyEvent(EmulationThread& emu, const KeyEvent& event) {
+    Chip8& chip = *emu.chip;
+    // A press is timed until the first frame published after it, see Frame::inputTime
+    if ((event.keys & ~emu.keys) && !emu.pressTime) emu.pressTime = event.time;
+    emu.keys = event.keys;
+    for (int i = 0; i < 16; ++i) {
+        chip.keypad[i] = (event.keys >> i) & 1;
+    }
+    if (emu.recording) recordKeys(*emu.recording, chip, event.keys);
+}
+
+// Every event from before `until`, all at once
+static void applyKeyEvents(EmulationThread& emu, int64_t until) {
+    KeyEvent event;
+    while (emu.input.peek(event) && event.time < until) {
+        applyKeyEvent(emu, event);
+        emu.input.pop();
+    }
+}
+
+// Where in a frame of `length` instructions or cycles an event at `time` goes,
+// in proportion to where it falls in the window of wall time
+static uint64_t offsetInFrame(int64_t time, int64_t windowStart, int64_t windowEnd, uint64_t length) {
+    if (time <= windowStart || windowEnd <= windowStart) return 0;
+    double fraction = (double)(time - windowStart) / (double)(windowEnd - windowStart);
+    return std::min(length, (uint64_t)(fraction * length));
+}
+
+// One frame, with the key events that arrived in [windowStart, windowEnd)
+// applied part way through it: an event that came a quarter of the way into
+// the window goes in a quarter of the way into the frame's instructions (or
+// VIP cycles). Each segment runs as fast as a whole frame would, through the
+// compiled ROM or the Jit and with idle loops skipped; the instruction stream
+// is what stepping with the same events would give, so recordings replay it.
+static void runFrameWithInput(EmulationThread& emu, int64_t windowStart, int64_t windowEnd) {
+    Chip8& chip = *emu.chip;
+    KeyEvent event;
+    if (emu.ips == IPS_VIP) {
+        // The cycle count this frame ends at, as runCyclesTimed will start it
+        const uint64_t frameEnd = chip.cycles >= chip.cycleDeadline ? chip.cycleDeadline + VIP_FRAME_CYCLES
+                                                                      : chip.cycleDeadline;
+        bool spent = false;
+        while (emu.input.peek(event) && event.time < windowEnd) {
+            uint64_t at = frameEnd - VIP_FRAME_CYCLES + offsetInFrame(event.time, windowStart, windowEnd, VIP_FRAME_CYCLES);
+            while (!spent && chip.cycles < at) spent = runCyclesTimed(chip, 1);
+            applyKeyEvent(emu, event);
+            emu.input.pop();
+        }
+        if (!spent) runCyclesTimed(chip, UINT64_MAX);
+        tickTimers(chip);
+        return;
+    }
+
+    const uint32_t instructions = instructionsForFrame(emu.ips, chip.frames);
+    const uint64_t frameStart = chip.instructionCount;
+    while (emu.input.peek(event) && event.time < windowEnd) {
+        uint64_t at = offsetInFrame(event.time, windowStart, windowEnd, instructions);
+        uint64_t done = chip.instructionCount - frameStart;
+        if (at > done) runInstructions(chip, at - done);
+        applyKeyEvent(emu, event);
+        emu.input.pop();
+    }
+    runFrame(chip, instructions - (uint32_t)(chip.instructionCount - frameStart));
+}
+
+static void emulationLoop(EmulationThread& emu) {
+    using clock = std::chrono::steady_clock;
+    const auto frameDuration = std::chrono::nanoseconds(1000000000 / 60);
+    Chip8& chip = *emu.chip;
+
+    auto start = clock::now();
+    uint64_t frame = 0;
+    std::vector<int16_t> samples;
+    publishFrame(emu, frame);
+    // Key events are taken a frame's worth of wall time at a time, from here on
+    int64_t windowStart = inputClock();
+
+    if (emu.recording) beginRecording(*emu.recording, chip, emu.ips);
+
+    while (emu.running.load(std::memory_order_relaxed)) {
+        int rom = emu.romRequest.exchange(-1, std::memory_order_relaxed);
+        if (rom >= 0) switchRom(emu, rom);
+        handleStateRequest(emu);
+        if (emu.debugger) handleDebugCommands(emu);
+
+        const int64_t windowEnd = inputClock();
+        const bool rewinding = emu.rewinding.load(std::memory_order_relaxed);
+        // Rewinding, paused or stopping at breakpoints there's no frame to spread input over
+        if (rewinding || emu.debugger) applyKeyEvents(emu, windowEnd);
+
+        // Fx18s are only logged for the audio output; drop any left from
+        // frames nothing played, or that a rewind or loaded state undid
+        chip.soundWriteCount = 0;
+
+        if (rewinding) {
+            // The newest entry is the current state, so step to the one before it.
+            // Restoring marks every row dirty, so the frame gets published below.
+            if (emu.history.rewind(chip, 1) && emu.recording) {
+                truncateLog(*emu.recording, chip.instructionCount);
+            }
+        } else if (!emu.debugger || !emu.debugger->paused()) {
+            // The frame schedule follows the machine's own frame count (or
+            // cycle count, on the VIP's timing) so rewinds, loaded states and
+            // replays all stay in step with it
+            uint64_t frameStart = chip.instructionCount;
+            bool soundOn = chip.sound_timer > 0;
+            bool finished = true;
+            {
+                ScopedTimer timer(chip.profiler ? &chip.profiler->emulate : nullptr);
+                if (emu.debugger) {
+                    finished = emu.debugger->runFrame(chip, emu.ips == IPS_VIP ? IPS_VIP : instructionsForFrame(emu.ips, chip.frames));
+                } else {
+                    runFrameWithInput(emu, windowStart, windowEnd);
+                }
+            }
+            if (emu.audio) playFrame(emu, frameStart, (uint32_t)(chip.instructionCount - frameStart), soundOn, samples);
+            // Rewinding back into the middle of a frame would lose the debugger's place in it
+            if (finished) emu.history.push(chip);
+            if (emu.debugger && emu.debugger->paused()) {
+                std::cout << emu.debugger->reason() << "\n";
+                emu.debugger->printState(chip, std::cout);
+                std::cout << std::flush;
+            }
+        }
+        // Every tick, paused or rewinding too, so the video runs in real time
+        if (emu.capture) emu.capture->push(chip.gfx, chip.hires);
+        frame++;
+        emu.frameCount.store(frame, std::memory_order_relaxed);
+        if (emu.config.profileInterval && frame % (emu.config.profileInterval * 60ull) == 0) {
+            saveProfile(emu);
+        }
+
+        windowStart = windowEnd;
+
+        // Only hand over frames that actually changed something on screen,
+        // or that follow a key press, to time how long it took to get there
+        if (chip.dirtyRows || emu.pressTime) {
+            chip.dirtyRows = 0;
+            publishFrame(emu, frame);
+        }
+
+        if (emu.config.unthrottled || emu.turbo.load(std::memory_order_relaxed)) {
+            // Keep the schedule on the wall clock, so leaving turbo picks up from now
+            start = clock::now() - frame * frameDuration;
+        } else {
+            auto deadline = start + frame * frameDuration;
+            auto now = clock::now();
+            if (now < deadline) {
+                std::this_thread::sleep_until(deadline);
+            } else if (now - deadline > 10 * frameDuration) {
+                // Fell far behind (debugger, suspended laptop...): don't try to catch up
+                start = now - frame * frameDuration;
+            }
+        }
+    }
+}
+
+void startEmulation(EmulationThread& emu, Chip8& chip, const SchedulerConfig& config) {
+    emu.config = config;
+    emu.ips = config.ips;
+    emu.chip = &chip;
+    emu.running = true;
+    emu.thread = std::thread(emulationLoop, std::ref(emu));
+}
+
+void pushDebugCommand(EmulationThread& emu, const std::string& line) {
+    std::lock_guard<std::mutex> lock(emu.debugMutex);
+    emu.debugCommands.push_back(line);
+}
+
+void stopEmulation(EmulationThread& emu) {
+    emu.running = false;
+    if (emu.thread.joinable()) emu.thread.join();
+    if (emu.chip) saveProfile(emu);
+    if (emu.recording) finishRecording(*emu.recording, *emu.chip);
+}
@@ -0,0 +1,85 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio.h"
+#include "broadcast.h"
+#include "capture.h"
+#include "chip8.h"
+#include "debugger.h"
+#include "input.h"
+#include "replay.h"
+#include "rewind.h"
+#include "romlib.h"
+#include "triple_buffer.h"
+
+// A completed frame as handed from the emulation thread to the renderer
+struct Frame {
+    uint64_t gfx[MAX_DISPLAY_WORDS];
+    bool hires;
+    uint64_t number;         // emulated frame count when it was published
+    int64_t inputTime;       // inputClock() of the first key press it shows the machine taking, 0 for none
+};
+
+struct SchedulerConfig {
+    uint32_t ips = 700;       // emulated instructions per second, unless the ROM's settings say otherwise; IPS_VIP for the VIP's timing
+    bool forceIps = false;    // ignore per-ROM speeds
+    QuirkProfile quirks = QuirkProfile::Modern; // for library ROMs whose settings don't pick one
+    bool forceQuirks = false; // ignore per-ROM quirk profiles
+    bool unthrottled = false; // run frames back to back instead of at 60Hz
+    uint32_t seed = 0;        // CXNN seed for ROMs loaded from the library
+    std::string statePath;    // where F5/F9 save and load the machine state
+    std::string profilePath;  // if set (and chip.profiler is), dump the profile here...
+    uint32_t profileInterval = 5; // ...every this many seconds of emulated time, and on exit
+};
+
+// Save state requests from the render thread, handled between frames
+enum class StateRequest : uint8_t { None, Save, Load };
+
+// Runs a Chip8 on its own thread on a fixed 60Hz timestep. Each emulated
+// frame executes ips/60 instructions and one timer tick, so CPU speed and
+// timers are tied to emulated time, not to how fast the host renders. Key
+// events that arrived during the last frame's worth of wall time are applied
+// part way through the next one, at the instruction matching when they came,
+// so input lags by at most a frame and keeps its timing within it.
+struct EmulationThread {
+    SchedulerConfig config;
+    uint32_t ips = 0;                      // current speed: config.ips or the running ROM's own
+    Chip8* chip = nullptr;
+    TripleBuffer<Frame> frames;            // emulation -> render
+    KeyQueue input;                        // render -> emulation, keypad changes
+    uint16_t keys = 0;                     // emulation thread: the keypad as of the last change applied
+    int64_t pressTime = 0;                 // emulation thread: a key press not yet shown in a published frame
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> frameCount{0};
+    std::atomic<bool> rewinding{false};    // while set, step back one frame per tick instead of running
+    std::atomic<bool> turbo{false};        // while set, run frames back to back like config.unthrottled
+    std::atomic<StateRequest> stateRequest{StateRequest::None};
+    RewindBuffer history;                  // owned by the emulation thread
+    InputLog* recording = nullptr;         // if set, input is logged here; read it after stopEmulation
+    RomLibrary* library = nullptr;         // ROMs to switch between, scanned before startEmulation
+    std::atomic<int> romRequest{-1};       // library index to switch to between frames
+    std::atomic<int> currentRom{-1};       // library index running now, -1 for a ROM loaded from elsewhere
+    SampleRing* audio = nullptr;           // emulation -> audio output, if there is one
+    Buzzer buzzer;                         // set buzzer.sampleRate to the output's before starting
+    std::atomic<uint64_t> droppedSamples{0}; // samples the output had no room for
+    VideoCapture* capture = nullptr;       // if set and open, every frame tick is pushed to it
+    BroadcastServer* broadcast = nullptr;  // if set and started, every published frame goes to it too
+    Debugger* debugger = nullptr;          // if set, frames run through it; owned by the emulation thread once started
+    std::mutex debugMutex;
+    std::vector<std::string> debugCommands; // any thread -> emulation, under debugMutex; see pushDebugCommand
+    std::thread thread;
+};
+
+void startEmulation(EmulationThread& emu, Chip8& chip, const SchedulerConfig& config);
+void stopEmulation(EmulationThread& emu);
+// Queue a debugger command line, carried out between frames
+void pushDebugCommand(EmulationThread& emu, const std::string& line);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,41 @@
+#include "sdl_audio.h"
+
+#include <cstring>
+#include <iostream>
+
+static void audioCallback(void* userdata, Uint8* stream, int length) {
+    AudioOutput& audio = *(AudioOutput*)userdata;
+    int16_t* samples = (int16_t*)stream;
+    size_t count = length / sizeof(int16_t);
+    size_t got = audio.ring.pop(samples, count);
+    if (got < count) {
+        memset(samples + got, 0, (count - got) * sizeof(int16_t));
+        audio.underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool openAudio(AudioOutput& audio) {
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq = audio.sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 256;    // ~5ms per callback
+    want.callback = audioCallback;
+    want.userdata = &audio;
+
+    // Let SDL pick another rate if it has to, the buzzer renders at whatever we get
+    audio.device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!audio.device) {
+        std::cerr << "SDL_OpenAudioDevice Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    audio.sampleRate = have.freq;
+    SDL_PauseAudioDevice(audio.device, 0);
+    return true;
+}
+
+void closeAudio(AudioOutput& audio) {
+    if (audio.device) SDL_CloseAudioDevice(audio.device);
+    audio.device = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef SDL_AUDIO_H
+#define SDL_AUDIO_H
+
+#include <atomic>
+#include <cstdint>
+#include <SDL2/SDL.h>
+
+#include "audio.h"
+
+// Plays what the emulation thread pushes into `ring`. SDL's callback pulls
+// small blocks straight out of the ring and plays silence when it runs dry,
+// so neither side ever waits for the other; the ring only holds a couple of
+// frames, which bounds the latency.
+struct AudioOutput {
+    SDL_AudioDeviceID device = 0;
+    int sampleRate = 48000;            // what the device actually opened with
+    SampleRing ring{2048};
+    std::atomic<uint64_t> underruns{0}; // callbacks that came up short
+};
+
+// Needs SDL_INIT_AUDIO; false (and no sound) if there's no usable device
+bool openAudio(AudioOutput& audio);
+void closeAudio(AudioOutput& audio);
+
+#endif // SDL_AUDIO_H
@@ -0,0 +1,78 @@
+#include "sdl_input.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+Keymap defaultKeymap() {
+    Keymap map;
+    for (int8_t& key : map.keys) key = -1;
+    static const SDL_Scancode layout[16] = {
+        SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+        SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+        SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
+    };
+    for (int key = 0; key < 16; ++key) {
+        map.keys[layout[key]] = (int8_t)key;
+    }
+    return map;
+}
+
+static std::string trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool loadKeymap(Keymap& map, const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open keymap: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        // Split at the last '=', key names like "=" aside
+        size_t equals = line.rfind('=');
+        std::string name = equals == std::string::npos ? "" : trim(line.substr(0, equals));
+        std::string value = equals == std::string::npos ? "" : trim(line.substr(equals + 1));
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name.c_str());
+        char* end = nullptr;
+        long key = value == "none" ? -1 : std::strtol(value.c_str(), &end, 16);
+        bool badKey = value != "none" && (value.empty() || *end != '\0' || key < 0 || key > 0xF);
+        if (scancode == SDL_SCANCODE_UNKNOWN || badKey) {
+            std::cerr << path << ":" << number << ": expected `KEY = 0-F`: " << line << std::endl;
+            return false;
+        }
+        map.keys[scancode] = (int8_t)key;
+    }
+    return true;
+}
+
+bool handleKeypadEvent(KeypadInput& input, const SDL_KeyboardEvent& event, KeyQueue& queue) {
+    const int key = input.map.keys[event.keysym.scancode];
+    if (key < 0) return false;
+    // Held keys repeat, but the keypad has no such thing
+    if (event.repeat) return true;
+
+    if (event.type == SDL_KEYDOWN) input.held[key]++;
+    else if (input.held[key] > 0) input.held[key]--;
+    uint16_t keys = input.keys;
+    if (input.held[key]) keys |= 1 << key;
+    else keys &= ~(1 << key);
+    if (keys == input.keys) return true;
+    input.keys = keys;
+
+    // SDL stamps events in ms when it queues them, which may be a while before they're polled
+    const uint32_t age = SDL_GetTicks() - event.timestamp;
+    const KeyEvent change = { inputClock() - (int64_t)age * 1000000, keys };
+    if (!queue.push(change)) std::cerr << "Key event queue full, dropped a key change" << std::endl;
+    return true;
+}
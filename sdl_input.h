@@ -0,0 +1,38 @@
+#ifndef SDL_INPUT_H
+#define SDL_INPUT_H
+
+#include <cstdint>
+#include <SDL2/SDL.h>
+
+#include "input.h"
+
+// Host keys to keypad keys, by scancode, so the keypad sits in the same
+// place on the keyboard whatever the layout says is printed on the keys
+struct Keymap {
+    int8_t keys[SDL_NUM_SCANCODES];    // keypad key, -1 for none
+};
+
+// The usual 4x4 block on the left of the keyboard:
+//   1 2 3 4      1 2 3 C
+//   Q W E R  ->  4 5 6 D
+//   A S D F      7 8 9 E
+//   Z X C V      A 0 B F
+Keymap defaultKeymap();
+// Read mappings over `map`, one `KEY = N` a line: KEY is an SDL key name
+// (`Q`, `Keypad 5`, `Up`...), N the keypad key in hex or `none` to unmap
+// it. `#` starts a comment. False (after printing the line) on a bad one.
+bool loadKeymap(Keymap& map, const char* path);
+
+// Folds host key events into keypad state. Several host keys can map to
+// one keypad key, which stays down until all of them are up.
+struct KeypadInput {
+    Keymap map = defaultKeymap();
+    uint8_t held[16] = {};             // host keys holding each keypad key down
+    uint16_t keys = 0;
+};
+
+// Handle a key event that maps to the keypad: a change is pushed to `queue`,
+// stamped with when SDL saw the event. Returns false for other keys.
+bool handleKeypadEvent(KeypadInput& input, const SDL_KeyboardEvent& event, KeyQueue& queue);
+
+#endif // SDL_INPUT_H
@@ -0,0 +1,99 @@
+// Terminal client for BroadcastServer: draws the broadcast display with
+// half-block characters, two pixel rows per line.
+//
+//   chip8_spectate <address> [--frames N] [--quiet]
+//
+// <address> is as for --broadcast: a port, HOST:PORT or unix:PATH. --frames
+// stops after N frames and --quiet skips drawing; either way it ends with a
+// count of what it received.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "broadcast.h"
+
+// Read exactly `size` bytes, false at the end of the stream
+static bool readAll(int fd, void* data, size_t size) {
+    uint8_t* out = (uint8_t*)data;
+    while (size > 0) {
+        ssize_t n = recv(fd, out, size, 0);
+        if (n <= 0) return false;
+        out += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void draw(const BroadcastView& view) {
+    const int width = screenWidth(view.hires), height = screenHeight(view.hires);
+    const int rowWords = screenWords(view.hires) / height;
+    auto pixel = [&](int x, int y) {
+        return (view.gfx[y * rowWords + (x >> 6)] >> (63 - (x & 63))) & 1;
+    };
+    std::string out = "\x1b[H";
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width; ++x) {
+            int cell = pixel(x, y) << 1 | pixel(x, y + 1);
+            static const char* const blocks[4] = { " ", "▄", "▀", "█" };
+            out += blocks[cell];
+        }
+        out += "\x1b[K\n";
+    }
+    out += "\x1b[J";
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::printf("frame %llu\n", (unsigned long long)view.frame);
+    std::fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    const char* address = nullptr;
+    uint64_t frames = 0;
+    bool quiet = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) frames = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--quiet") quiet = true;
+        else address = argv[i];
+    }
+    if (!address) {
+        std::fprintf(stderr, "usage: chip8_spectate <port | host:port | unix:path> [--frames N] [--quiet]\n");
+        return 1;
+    }
+
+    int fd = openBroadcastSocket(address, false);
+    if (fd < 0) return 1;
+    if (!quiet) std::printf("\x1b[2J");
+
+    BroadcastView view;
+    std::vector<uint8_t> payload;
+    uint64_t received = 0, keyframes = 0, bytes = 0;
+    BroadcastHeader header;
+    while ((!frames || received < frames) && readAll(fd, &header, sizeof(header))) {
+        if (header.size > MAX_DISPLAY_WORDS * sizeof(uint64_t) * 2) {
+            std::fprintf(stderr, "Bad message from the server\n");
+            break;
+        }
+        payload.resize(header.size);
+        if (!readAll(fd, payload.data(), payload.size())) break;
+        if (!decodeBroadcast(view, header, payload.data())) {
+            std::fprintf(stderr, "Bad message from the server\n");
+            break;
+        }
+        received++;
+        keyframes += header.type == BROADCAST_KEYFRAME;
+        bytes += sizeof(header) + header.size;
+        // Only draw the newest of what has arrived, so a slow terminal skips frames rather than lagging
+        uint8_t next;
+        if (!quiet && recv(fd, &next, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) draw(view);
+    }
+    close(fd);
+
+    std::printf("%llu frames (%llu keyframes), %llu bytes, last frame %llu\n", (unsigned long long)received,
+                (unsigned long long)keyframes, (unsigned long long)bytes, (unsigned long long)view.frame);
+    return 0;
+}
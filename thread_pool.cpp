@@ -0,0 +1,129 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned index = nextQueue++ % queues.size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    // Take the sleep lock so a worker can't miss the wakeup between checking and waiting
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    workAvailable.notify_one();
+}
+
+void ThreadPool::runJob(size_t count, void (*fn)(void*, size_t), void* context) {
+    if (count == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        jobFn = fn;
+        jobContext = context;
+        jobCount = count;
+        jobNext = 0;
+        jobRemaining = count;
+        jobGeneration++;
+    }
+    workAvailable.notify_all();
+    helpWithJob();
+    // Done once every index has run and no worker is still looking for one
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    allDone.wait(lock, [this] { return jobRemaining == 0 && jobHelpers == 0; });
+}
+
+void ThreadPool::helpWithJob() {
+    for (size_t i; (i = jobNext.fetch_add(1)) < jobCount;) {
+        jobFn(jobContext, i);
+        if (--jobRemaining == 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            allDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    allDone.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::popLocal(unsigned index, std::function<void()>& task) {
+    Queue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned thief, std::function<void()>& task) {
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& victim = *queues[(thief + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    std::function<void()> task;
+    uint64_t seenJob = 0;
+    while (true) {
+        if (popLocal(index, task) || steal(index, task)) {
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                allDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (stopping) return;
+        // Join a parallelFor that still has indices left; runJob can't return (and start
+        // another) while any worker is in helpWithJob
+        if (seenJob != jobGeneration) {
+            seenJob = jobGeneration;
+            if (jobRemaining > 0) {
+                jobHelpers++;
+                lock.unlock();
+                helpWithJob();
+                lock.lock();
+                if (--jobHelpers == 0 && jobRemaining == 0) allDone.notify_all();
+                continue;
+            }
+        }
+        // Re-check under the lock; submit() takes it before notifying
+        bool haveWork = false;
+        for (auto& queue : queues) {
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            if (!queue->tasks.empty()) { haveWork = true; break; }
+        }
+        if (!haveWork) workAvailable.wait(lock);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing thread pool.
+//
+// Each worker owns a deque: it pops its own tasks from the back and, when it
+// runs dry, steals from the front of the other workers' deques. Tasks
+// submitted from outside the pool are dealt round-robin.
+//
+// parallelFor is the allocation-free path for work that repeats, like
+// stepping a batch: there's one job at a time, and the workers and the
+// caller pull its indices off a shared counter.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Block until every submitted task has finished
+    void wait();
+
+    // Run body(i) for every i in [0, count) on the workers and the calling
+    // thread, returning once all have finished. Constructs nothing, so it
+    // never allocates. One caller at a time.
+    template <typename F>
+    void parallelFor(size_t count, F& body) {
+        runJob(count, [](void* context, size_t i) { (*(F*)context)(i); }, &body);
+    }
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool popLocal(unsigned index, std::function<void()>& task);
+    bool steal(unsigned thief, std::function<void()>& task);
+    void workerLoop(unsigned index);
+    void runJob(size_t count, void (*fn)(void*, size_t), void* context);
+    void helpWithJob();
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> nextQueue{0};
+    std::atomic<size_t> pending{0};   // submitted but not yet finished
+    std::atomic<bool> stopping{false};
+
+    // The parallelFor job; set under sleepMutex, and only while no worker is helping with the last one
+    void (*jobFn)(void*, size_t) = nullptr;
+    void* jobContext = nullptr;
+    size_t jobCount = 0;
+    uint64_t jobGeneration = 0;
+    std::atomic<size_t> jobNext{0};       // next index to hand out
+    std::atomic<size_t> jobRemaining{0};  // indices not yet finished
+    unsigned jobHelpers = 0;              // workers in helpWithJob, under sleepMutex
+
+    std::mutex sleepMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+};
+
+#endif // THREAD_POOL_H
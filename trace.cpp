@@ -0,0 +1,103 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <fstream>
+
+// Trace file: "C8TR", uint32 version, uint64 record count, then the records
+static const char TRACE_MAGIC[4] = { 'C', '8', 'T', 'R' };
+static const uint32_t TRACE_VERSION = 1;
+
+bool TraceRing::save(const char* path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    uint64_t count = size();
+    file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    file.write((const char*)&TRACE_VERSION, sizeof(TRACE_VERSION));
+    file.write((const char*)&count, sizeof(count));
+    for (size_t i = 0; i < count; ++i) {
+        file.write((const char*)&at(i), sizeof(TraceRecord));
+    }
+    return (bool)file;
+}
+
+bool loadTrace(const char* path, std::vector<TraceRecord>& records) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    file.read((char*)&count, sizeof(count));
+    if (!file || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 || version != TRACE_VERSION) return false;
+    // The records must be what's left of the file, so a corrupt count can't ask for gigabytes
+    std::streamoff offset = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - offset;
+    file.seekg(offset);
+    if (remaining < 0 || count > (uint64_t)remaining / sizeof(TraceRecord)) return false;
+
+    records.resize(count);
+    file.read((char*)records.data(), count * sizeof(TraceRecord));
+    return (bool)file;
+}
+
+void disassemble(uint16_t opcode, char* out, size_t size) {
+    unsigned x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF;
+    unsigned n = opcode & 0xF, nn = opcode & 0xFF, nnn = opcode & 0xFFF;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) { snprintf(out, size, "CLS"); return; }
+            if (opcode == 0x00EE) { snprintf(out, size, "RET"); return; }
+            if ((opcode & 0xFFF0) == 0x00C0) { snprintf(out, size, "SCD %u", n); return; }
+            if ((opcode & 0xFFF0) == 0x00D0) { snprintf(out, size, "SCU %u", n); return; }
+            if (opcode == 0x00FB) { snprintf(out, size, "SCR"); return; }
+            if (opcode == 0x00FC) { snprintf(out, size, "SCL"); return; }
+            if (opcode == 0x00FD) { snprintf(out, size, "EXIT"); return; }
+            if (opcode == 0x00FE) { snprintf(out, size, "LOW"); return; }
+            if (opcode == 0x00FF) { snprintf(out, size, "HIGH"); return; }
+            break;
+        case 0x1000: snprintf(out, size, "JP 0x%03X", nnn); return;
+        case 0x2000: snprintf(out, size, "CALL 0x%03X", nnn); return;
+        case 0x3000: snprintf(out, size, "SE V%X, 0x%02X", x, nn); return;
+        case 0x4000: snprintf(out, size, "SNE V%X, 0x%02X", x, nn); return;
+        case 0x5000: if (n == 0) { snprintf(out, size, "SE V%X, V%X", x, y); return; } break;
+        case 0x6000: snprintf(out, size, "LD V%X, 0x%02X", x, nn); return;
+        case 0x7000: snprintf(out, size, "ADD V%X, 0x%02X", x, nn); return;
+        case 0x8000: {
+            static const char* const names[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr
+            };
+            if (names[n]) { snprintf(out, size, "%s V%X, V%X", names[n], x, y); return; }
+            break;
+        }
+        case 0x9000: if (n == 0) { snprintf(out, size, "SNE V%X, V%X", x, y); return; } break;
+        case 0xA000: snprintf(out, size, "LD I, 0x%03X", nnn); return;
+        case 0xB000: snprintf(out, size, "JP V0, 0x%03X", nnn); return;
+        case 0xC000: snprintf(out, size, "RND V%X, 0x%02X", x, nn); return;
+        case 0xD000: snprintf(out, size, "DRW V%X, V%X, %u", x, y, n); return;
+        case 0xE000:
+            if (nn == 0x9E) { snprintf(out, size, "SKP V%X", x); return; }
+            if (nn == 0xA1) { snprintf(out, size, "SKNP V%X", x); return; }
+            break;
+        case 0xF000:
+            switch (nn) {
+                case 0x07: snprintf(out, size, "LD V%X, DT", x); return;
+                case 0x0A: snprintf(out, size, "LD V%X, K", x); return;
+                case 0x15: snprintf(out, size, "LD DT, V%X", x); return;
+                case 0x18: snprintf(out, size, "LD ST, V%X", x); return;
+                case 0x1E: snprintf(out, size, "ADD I, V%X", x); return;
+                case 0x29: snprintf(out, size, "LD F, V%X", x); return;
+                case 0x30: snprintf(out, size, "LD HF, V%X", x); return;
+                case 0x33: snprintf(out, size, "LD B, V%X", x); return;
+                case 0x55: snprintf(out, size, "LD [I], V%X", x); return;
+                case 0x65: snprintf(out, size, "LD V%X, [I]", x); return;
+                case 0x75: snprintf(out, size, "LD R, V%X", x); return;
+                case 0x85: snprintf(out, size, "LD V%X, R", x); return;
+            }
+            break;
+    }
+    snprintf(out, size, "DW 0x%04X", opcode);
+}
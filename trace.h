@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "chip8.h"
+
+// Execution tracing.
+//
+// The dispatch loop is a template on a trace policy with before()/after()
+// hooks around every instruction (after() also gets the next pc). runCycles uses NoTrace, whose hooks are
+// empty, so release builds contain no trace code at all. Builds compiled
+// with -DCHIP8_TRACE route runCycles through TraceRing whenever chip.trace
+// is set, recording binary TraceRecords; turning them into text is left to
+// the offline decoder (tracedump.cpp).
+
+// One executed instruction, 16 bytes
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;          // after the instruction
+    uint16_t changed;    // bit per V register the instruction changed
+    uint8_t values[8];   // new values of the first 8 changed registers, lowest register first
+};
+
+struct NoTrace {
+    void before(const Chip8&, uint16_t) {}
+    void after(const Chip8&, uint16_t) {}
+};
+
+// Keeps the most recent `capacity` records
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity = 1 << 16) : records(capacity ? capacity : 1) {}
+
+    void before(const Chip8& chip, uint16_t pc) {
+        pending.pc = pc & 0xFFF;
+        pending.opcode = chip.memory[pc & 0xFFF] << 8 | chip.memory[(pc + 1) & 0xFFF];
+        memcpy(previousV, chip.V, sizeof(previousV));
+    }
+
+    void after(const Chip8& chip, uint16_t) {
+        pending.I = chip.I;
+        pending.changed = 0;
+        int stored = 0;
+        for (int i = 0; i < 16; ++i) {
+            if (chip.V[i] == previousV[i]) continue;
+            pending.changed |= 1 << i;
+            if (stored < 8) pending.values[stored++] = chip.V[i];
+        }
+        for (; stored < 8; ++stored) pending.values[stored] = 0;
+        records[total % records.size()] = pending;
+        total++;
+    }
+
+    // Number of records currently held
+    size_t size() const { return total < records.size() ? (size_t)total : records.size(); }
+    // Total instructions recorded, including ones that have been overwritten
+    uint64_t recorded() const { return total; }
+    // i-th held record, oldest first
+    const TraceRecord& at(size_t i) const {
+        size_t first = total < records.size() ? 0 : (size_t)(total % records.size());
+        return records[(first + i) % records.size()];
+    }
+
+    void clear() { total = 0; }
+
+    // Write the held records, oldest first, to a binary trace file
+    bool save(const char* path) const;
+
+private:
+    std::vector<TraceRecord> records;
+    uint64_t total = 0;
+    TraceRecord pending = {};
+    uint8_t previousV[16] = {};
+};
+
+// The dispatch loop of runCycles with trace hooks around each instruction.
+// pc stays in a register for the whole run instead of round-tripping through
+// chip.pc; instructionCount is only stored (never reloaded), so handlers see
+// their exact position for next to nothing.
+template <typename Trace>
+void runCyclesTraced(Chip8& chip, uint64_t count, Trace& trace) {
+    uint16_t pc = chip.pc;
+    const uint64_t base = chip.instructionCount;
+    for (uint64_t i = 0; i < count; ++i) {
+        const DecodedOp& op = chip.decoded[pc & 0xFFF];
+        chip.instructionCount = base + i;
+        trace.before(chip, pc);
+        pc = op.handler(chip, op, pc);
+        trace.after(chip, pc);
+    }
+    chip.pc = pc;
+    chip.instructionCount = base + count;
+}
+
+// Load every record from a file written by TraceRing::save
+bool loadTrace(const char* path, std::vector<TraceRecord>& records);
+
+// Mnemonic for an opcode, e.g. "ADD V3, 0x01"
+void disassemble(uint16_t opcode, char* out, size_t size);
+
+#endif // TRACE_H
@@ -0,0 +1,47 @@
+// Offline decoder for binary execution traces written by TraceRing::save.
+//
+//   chip8_tracedump <trace file> [--last N]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+int main(int argc, char* argv[]) {
+    const char* path = nullptr;
+    size_t last = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--last" && i + 1 < argc) last = std::strtoull(argv[++i], nullptr, 10);
+        else path = argv[i];
+    }
+    if (!path) {
+        std::fprintf(stderr, "usage: chip8_tracedump <trace file> [--last N]\n");
+        return 1;
+    }
+
+    std::vector<TraceRecord> records;
+    if (!loadTrace(path, records)) {
+        std::fprintf(stderr, "Can't read trace file: %s\n", path);
+        return 1;
+    }
+
+    size_t first = last && last < records.size() ? records.size() - last : 0;
+    char text[32];
+    for (size_t i = first; i < records.size(); ++i) {
+        const TraceRecord& r = records[i];
+        disassemble(r.opcode, text, sizeof(text));
+        std::printf("%03X: %04X  %-18s I=%03X", r.pc, r.opcode, text, r.I);
+        int stored = 0;
+        for (int v = 0; v < 16; ++v) {
+            if (!((r.changed >> v) & 1)) continue;
+            if (stored < 8) std::printf(" V%X=%02X", v, r.values[stored]);
+            else std::printf(" V%X=?", v);
+            stored++;
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
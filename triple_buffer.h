@@ -0,0 +1,46 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer triple buffer.
+//
+// The producer always has a private back slot to write into and publishes it
+// by swapping it with the shared middle slot; the consumer swaps its front
+// slot with the middle one only when something new was published. Neither
+// side ever waits on the other, and the consumer always sees a complete
+// frame, never one that is half written.
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer: the slot to fill in before calling publish()
+    T& back() { return slots[backIndex]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        backIndex = previous & INDEX_MASK;
+    }
+
+    // Consumer: pick up the newest published slot, returns false if nothing new
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer: the most recently picked up slot
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T slots[3] = {};
+    uint8_t backIndex = 0;             // owned by the producer
+    uint8_t frontIndex = 1;            // owned by the consumer
+    std::atomic<uint8_t> middle{2};    // shared: slot index plus the FRESH bit
+};
+
+#endif // TRIPLE_BUFFER_H